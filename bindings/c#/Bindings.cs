@@ -71,6 +71,16 @@ internal static class Bindings
     public static extern void led_canvas_set_pixels(IntPtr canvas, int x, int y, int width, int height,
                                                     ref Color colors);
 
+    [DllImport(Lib)]
+    public static extern void led_canvas_set_pixel_buffer(IntPtr canvas, int x, int y, int width, int height,
+                                                          ref byte pixels, int stride, PixelFormat format);
+
+    [DllImport(Lib)]
+    public static extern void led_canvas_copy(IntPtr dst, IntPtr src);
+
+    [DllImport(Lib)]
+    public static extern void led_canvas_copy_region(IntPtr dst, IntPtr src, int x, int y, int width, int height);
+
     [DllImport(Lib)]
     public static extern void led_canvas_clear(IntPtr canvas);
 
@@ -0,0 +1,15 @@
+namespace RPiRgbLEDMatrix;
+
+/// <summary>
+/// Memory layouts of pixels for <see cref="RGBLedCanvas.SetPixels(int, int, int, int, ReadOnlySpan{byte}, PixelFormat, int)"/>.
+/// The alpha byte of four-byte formats is ignored.
+/// </summary>
+public enum PixelFormat
+{
+    Rgb24 = 0,
+    Bgr24 = 1,
+    Rgba32 = 2,
+    Bgra32 = 3,
+    Argb32 = 4,
+    Abgr32 = 5
+}
@@ -1,3 +1,5 @@
+using System.Runtime.InteropServices;
+
 namespace RPiRgbLEDMatrix;
 
 /// <summary>
@@ -52,6 +54,57 @@ public class RGBLedCanvas
         led_canvas_set_pixels(_canvas, x, y, width, height, ref colors[0]);
     }
 
+    /// <summary>
+    /// Copies an image in memory, e.g. a decoded image or a video frame, to a rectangle on the canvas.
+    /// The pixels are passed on to the native library as they are, without copying or converting them first.
+    /// Parts outside the canvas are clipped.
+    /// </summary>
+    /// <param name="x">The X coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="y">The Y coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="width">Width of the image.</param>
+    /// <param name="height">Height of the image.</param>
+    /// <param name="pixels">Buffer containing the image.</param>
+    /// <param name="format">Layout of the pixels in the buffer.</param>
+    /// <param name="stride">Bytes from the start of one row to the next; 0 if the rows follow each other directly.</param>
+    public void SetPixels(int x, int y, int width, int height, ReadOnlySpan<byte> pixels,
+                          PixelFormat format = PixelFormat.Rgb24, int stride = 0)
+    {
+        var bytesPerPixel = format switch
+        {
+            PixelFormat.Rgb24 or PixelFormat.Bgr24 => 3,
+            PixelFormat.Rgba32 or PixelFormat.Bgra32 or PixelFormat.Argb32 or PixelFormat.Abgr32 => 4,
+            _ => throw new ArgumentOutOfRangeException(nameof(format))
+        };
+        if (width <= 0 || height <= 0)
+            return;
+        if (stride == 0)
+            stride = width * bytesPerPixel;
+        if (stride < width * bytesPerPixel)
+            throw new ArgumentOutOfRangeException(nameof(stride));
+        if (pixels.Length < (long)stride * (height - 1) + width * bytesPerPixel)
+            throw new ArgumentOutOfRangeException(nameof(pixels));
+        led_canvas_set_pixel_buffer(_canvas, x, y, width, height,
+                                    ref MemoryMarshal.GetReference(pixels), stride, format);
+    }
+
+    /// <summary>
+    /// Copies everything from another canvas of the same matrix.
+    /// </summary>
+    /// <param name="source">Canvas to copy from.</param>
+    public void CopyFrom(RGBLedCanvas source) => led_canvas_copy(_canvas, source._canvas);
+
+    /// <summary>
+    /// Copies a rectangle from another canvas of the same matrix to the same place on this canvas.
+    /// Much cheaper than setting its pixels again.
+    /// </summary>
+    /// <param name="source">Canvas to copy from.</param>
+    /// <param name="x">The X coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="y">The Y coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="width">Width of the rectangle.</param>
+    /// <param name="height">Height of the rectangle.</param>
+    public void CopyRegionFrom(RGBLedCanvas source, int x, int y, int width, int height) =>
+        led_canvas_copy_region(_canvas, source._canvas, x, y, width, height);
+
     /// <summary>
     /// Sets the color of the entire canvas.
     /// </summary>
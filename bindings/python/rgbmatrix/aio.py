@@ -0,0 +1,117 @@
+# -*- coding: utf-8 -*-
+"""asyncio interface to the matrix.
+
+Waiting for the vsync or for a GPIO input change does not block the event
+loop, so one process can run an animation, serve network requests and react
+on buttons at the same time, without threads:
+
+    matrix = RGBMatrix(options=options)
+    display = AsyncMatrix(matrix)
+    canvas = matrix.CreateFrameCanvas()
+    while True:
+        draw(canvas)
+        canvas = await display.SwapOnVSync(canvas)
+
+Both are backed by file descriptors the refresh thread makes readable, which
+are registered with the event loop while someone waits.
+"""
+
+import asyncio
+import os
+
+
+class _EventFd(object):
+    """Futures resolved when an eventfd becomes readable."""
+
+    def __init__(self, fd):
+        self._fd = fd
+        self._loop = None
+        self._waiters = []
+
+    def reset(self):
+        """Forget earlier events, unless someone is waiting for them."""
+        if not self._waiters:
+            self._drain()
+
+    def _drain(self):
+        try:
+            os.read(self._fd, 8)
+        except BlockingIOError:
+            pass
+
+    async def wait(self):
+        if self._loop is None:
+            self._loop = asyncio.get_running_loop()
+        future = self._loop.create_future()
+        if not self._waiters:
+            self._loop.add_reader(self._fd, self._ready)
+        self._waiters.append(future)
+        try:
+            await future
+        finally:
+            if future in self._waiters:  # Cancelled.
+                self._waiters.remove(future)
+                if not self._waiters:
+                    self._loop.remove_reader(self._fd)
+
+    def close(self):
+        if self._waiters:
+            self._loop.remove_reader(self._fd)
+        for future in self._waiters:
+            future.cancel()
+        self._waiters = []
+
+    def _ready(self):
+        self._drain()
+        self._loop.remove_reader(self._fd)
+        waiters, self._waiters = self._waiters, []
+        for future in waiters:
+            if not future.done():
+                future.set_result(None)
+
+
+class AsyncMatrix(object):
+    """Awaitable SwapOnVSync() and AwaitInputChange() for an RGBMatrix.
+
+    Needs the refresh thread of the matrix, which runs unless the matrix
+    was created without GPIO access.
+    """
+
+    def __init__(self, matrix):
+        if matrix.vsync_fd < 0 or matrix.input_fd < 0:
+            raise RuntimeError("Matrix has no refresh thread")
+        self._matrix = matrix
+        self._vsync = _EventFd(matrix.vsync_fd)
+        self._input = _EventFd(matrix.input_fd)
+        self._swap_lock = asyncio.Lock()
+
+    @property
+    def matrix(self):
+        return self._matrix
+
+    async def SwapOnVSync(self, canvas, framerate_fraction=1):
+        """Show "canvas" with the next vsync and return the canvas shown
+        before, to draw the next frame into. Concurrent calls are shown one
+        after another.
+
+        If the call is cancelled, the canvas is still shown, but the
+        returned canvas is lost; create a new one.
+        """
+        async with self._swap_lock:
+            self._vsync.reset()
+            previous = self._matrix.ScheduleSwap(canvas, framerate_fraction)
+            await self._vsync.wait()
+            return previous
+
+    async def AwaitInputChange(self):
+        """Wait until any of the inputs requested with
+        matrix.RequestInputs() changes and return the state of all inputs.
+        Use asyncio.wait_for() for a timeout."""
+        self._input.reset()
+        await self._input.wait()
+        return self._matrix.AwaitInputChange(0)
+
+    def close(self):
+        """Stop waiting; pending calls are cancelled."""
+        self._vsync.close()
+        self._input.close()
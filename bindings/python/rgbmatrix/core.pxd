@@ -1,4 +1,5 @@
 # cython: language_level=3str
+from libcpp cimport bool
 from . cimport cppinc
 
 cdef class Canvas:
@@ -6,10 +7,35 @@ cdef class Canvas:
 
 cdef class FrameCanvas(Canvas):
     cdef cppinc.FrameCanvas *__canvas
+    # The RGBMatrix owning the canvas; keeps it alive as long as the canvas
+    # can still be used, even from a thread without the GIL.
+    cdef object __owner
 
 cdef class RGBMatrix(Canvas):
     cdef cppinc.RGBMatrix *__matrix
 
+cdef class StreamIO:
+    cdef cppinc.StreamIO *_io
+
+cdef class FileStreamIO(StreamIO):
+    pass
+
+cdef class MemMapViewInput(StreamIO):
+    pass
+
+cdef class StreamWriter:
+    cdef cppinc.StreamWriter *_writer
+    cdef StreamIO _stream
+
+cdef class StreamReader:
+    cdef cppinc.StreamReader *_reader
+    cdef StreamIO _stream
+
+cdef class StreamPlayer:
+    cdef cppinc.StreamPlayer *_player
+    cdef RGBMatrix _matrix
+    cdef bool _stop
+
 cdef class RGBMatrixOptions:
     cdef cppinc.Options __options
     cdef cppinc.RuntimeOptions __runtime_options
@@ -1,8 +1,11 @@
 # distutils: language = c++
 
 from libcpp cimport bool
-from libc.stdint cimport uint8_t, uint32_t, uintptr_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uintptr_t
+from cpython.exc cimport PyErr_CheckSignals
+from cython.operator cimport dereference
 import cython
+import os
 
 cdef extern from "Python.h":
     void* PyCapsule_GetPointer(object capsule, const char* name)
@@ -28,44 +31,84 @@ cdef class Canvas:
         if (image.mode != "RGB"):
             raise Exception("Currently, only RGB mode is supported for SetImage(). Please create images with mode 'RGB' or convert first with image = image.convert('RGB'). Pull requests to support more modes natively are also welcome :)")
 
+        img_width, img_height = image.size
         if unsafe:
             #In unsafe mode we directly access the underlying PIL image array
             #in cython, which is considered unsafe pointer accecss,
             #however it's super fast and seems to work fine
             #https://groups.google.com/forum/#!topic/cython-users/Dc1ft5W6KM4
-            img_width, img_height = image.size
             self.SetPixelsPillow(offset_x, offset_y, img_width, img_height, image.getim())
         else:
-            # First implementation of a SetImage(). OPTIMIZE_ME: A more native
-            # implementation that directly reads the buffer and calls the underlying
-            # C functions can certainly be faster.
-            img_width, img_height = image.size
-            pixels = image.load()
-            for x in range(max(0, -offset_x), min(img_width, self.width - offset_x)):
-                for y in range(max(0, -offset_y), min(img_height, self.height - offset_y)):
-                    (r, g, b) = pixels[x, y]
-                    self.SetPixel(x + offset_x, y + offset_y, r, g, b)
+            # Let Pillow hand out a copy of the pixels.
+            self.SetBuffer(image.tobytes(), img_width, img_height,
+                           offset_x, offset_y)
 
     @cython.boundscheck(False)
     @cython.wraparound(False)
     def SetPixelsPillow(self, int xstart, int ystart, int width, int height, object image_capsule):
-        cdef cppinc.FrameCanvas* my_canvas = <cppinc.FrameCanvas*>self._getCanvas()
-        cdef int frame_width = my_canvas.width()
-        cdef int frame_height = my_canvas.height()
-        cdef int row, col
-        cdef uint8_t r, g, b
+        cdef cppinc.Canvas* my_canvas = self._getCanvas()
+        cdef int row
         cdef int **buffer
-        cdef int pixel
 
         buffer = get_pillow_buffer(image_capsule)
 
-        for col in range(max(0, -xstart), min(width, frame_width - xstart)):
-            for row in range(max(0, -ystart), min(height, frame_height - ystart)):
-                pixel = buffer[row][col]
-                r = (pixel ) & 0xFF
-                g = (pixel >> 8) & 0xFF
-                b = (pixel >> 16) & 0xFF
-                my_canvas.SetPixel(xstart+col, ystart+row, r, g, b)
+        # Rows of 32 bit pixels with red in the lowest byte. Pillow might not
+        # keep the rows of an image in one block, so this goes row by row.
+        with nogil:
+            for row in range(height):
+                my_canvas.SetPixelBuffer(xstart, ystart + row, width, 1,
+                                         <const uint8_t*>buffer[row], 4, 0,
+                                         False)
+
+    # Show "width" x "height" pixels from any object supporting the buffer
+    # protocol, such as bytes, bytearray or memoryview. Each pixel has
+    # "bytes_per_pixel" bytes, starting with red, green and blue (so 3 for
+    # RGB, 4 for RGBA; alpha is ignored). Rows are "stride" bytes apart,
+    # or just one after another if 0.
+    # The pixels are copied natively, without holding the GIL, so other
+    # Python threads keep running in the meantime.
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    def SetBuffer(self, const uint8_t[::1] buffer, int width, int height,
+                  int offset_x = 0, int offset_y = 0,
+                  int bytes_per_pixel = 3, int stride = 0):
+        cdef cppinc.Canvas* my_canvas = self._getCanvas()
+        if bytes_per_pixel < 3:
+            raise ValueError("Need at least 3 bytes per pixel")
+        if stride == 0:
+            stride = width * bytes_per_pixel
+        if width <= 0 or height <= 0:
+            return
+        if (stride < width * bytes_per_pixel
+            or buffer.shape[0] < (height - 1) * stride + width * bytes_per_pixel):
+            raise ValueError("Buffer too small for %dx%d pixels" % (width, height))
+        with nogil:
+            my_canvas.SetPixelBuffer(offset_x, offset_y, width, height,
+                                     &buffer[0], bytes_per_pixel, stride,
+                                     False)
+
+    # Show an array of height x width x channels bytes, e.g. a NumPy array
+    # of dtype uint8 with shape (height, width, 3) for RGB or 4 for RGBA.
+    # Slices and other views with strides work as well, as long as the
+    # color channels of a pixel are next to each other.
+    # Like SetBuffer(), this copies natively without holding the GIL.
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    def SetArray(self, const uint8_t[:, :, :] array,
+                 int offset_x = 0, int offset_y = 0):
+        cdef cppinc.Canvas* my_canvas = self._getCanvas()
+        if array.shape[2] < 3:
+            raise ValueError("Expected an array of height x width x 3 (RGB) or 4 (RGBA)")
+        if array.strides[2] != 1:
+            raise ValueError("The color channels of a pixel need to be adjacent in memory")
+        if array.shape[0] == 0 or array.shape[1] == 0:
+            return
+        with nogil:
+            my_canvas.SetPixelBuffer(offset_x, offset_y,
+                                     array.shape[1], array.shape[0],
+                                     &array[0, 0, 0],
+                                     array.strides[1], array.strides[0],
+                                     False)
 
 cdef class FrameCanvas(Canvas):
     def __dealloc__(self):
@@ -78,10 +121,14 @@ cdef class FrameCanvas(Canvas):
         raise Exception("Canvas was destroyed or not initialized, you cannot use this object anymore")
 
     def Fill(self, uint8_t red, uint8_t green, uint8_t blue):
-        (<cppinc.FrameCanvas*>self._getCanvas()).Fill(red, green, blue)
+        cdef cppinc.FrameCanvas* my_canvas = <cppinc.FrameCanvas*>self._getCanvas()
+        with nogil:
+            my_canvas.Fill(red, green, blue)
 
     def Clear(self):
-        (<cppinc.FrameCanvas*>self._getCanvas()).Clear()
+        cdef cppinc.FrameCanvas* my_canvas = <cppinc.FrameCanvas*>self._getCanvas()
+        with nogil:
+            my_canvas.Clear()
 
     def SetPixel(self, int x, int y, uint8_t red, uint8_t green, uint8_t blue):
         (<cppinc.FrameCanvas*>self._getCanvas()).SetPixel(x, y, red, green, blue)
@@ -248,16 +295,20 @@ cdef class RGBMatrix(Canvas):
         raise Exception("Canvas was destroyed or not initialized, you cannot use this object anymore")
 
     def Fill(self, uint8_t red, uint8_t green, uint8_t blue):
-        self.__matrix.Fill(red, green, blue)
+        cdef cppinc.RGBMatrix* matrix = self.__matrix
+        with nogil:
+            matrix.Fill(red, green, blue)
 
     def SetPixel(self, int x, int y, uint8_t red, uint8_t green, uint8_t blue):
         self.__matrix.SetPixel(x, y, red, green, blue)
 
     def Clear(self):
-        self.__matrix.Clear()
+        cdef cppinc.RGBMatrix* matrix = self.__matrix
+        with nogil:
+            matrix.Clear()
 
     def CreateFrameCanvas(self):
-        return __createFrameCanvas(self.__matrix.CreateFrameCanvas())
+        return __createFrameCanvas(self.__matrix.CreateFrameCanvas(), self)
 
     # The optional "framerate_fraction" parameter allows to choose which
     # multiple of the global frame-count to use. So it slows down your animation
@@ -267,8 +318,51 @@ cdef class RGBMatrix(Canvas):
     # 28Hz animation, nicely locked to the refresh-rate).
     # If you combine this with RGBMatrixOptions.limit_refresh_rate_hz you can create
     # time-correct animations.
+    # While waiting for the vsync, the GIL is released, so other Python
+    # threads can prepare the next frame in the meantime.
     def SwapOnVSync(self, FrameCanvas newFrame, uint8_t framerate_fraction = 1):
-        return __createFrameCanvas(self.__matrix.SwapOnVSync(newFrame.__canvas, framerate_fraction))
+        cdef cppinc.RGBMatrix* matrix = self.__matrix
+        cdef cppinc.FrameCanvas* new_canvas = <cppinc.FrameCanvas*>newFrame._getCanvas()
+        cdef cppinc.FrameCanvas* previous
+        with nogil:
+            previous = matrix.SwapOnVSync(new_canvas, framerate_fraction)
+        return __createFrameCanvas(previous, self)
+
+    # Like SwapOnVSync(), but returns right away. The returned canvas must
+    # not be drawn into before the swap happened, which is signaled by
+    # vsync_fd becoming readable. See rgbmatrix.aio for an asyncio
+    # interface built on top of this.
+    def ScheduleSwap(self, FrameCanvas newFrame, uint8_t framerate_fraction = 1):
+        cdef cppinc.FrameCanvas* previous = self.__matrix.ScheduleSwap(
+            <cppinc.FrameCanvas*>newFrame._getCanvas(), framerate_fraction)
+        if previous == NULL:
+            raise RuntimeError("No refresh thread running")
+        return __createFrameCanvas(previous, self)
+
+    # Request GPIO bits to be read with AwaitInputChange(); returns the
+    # bits that are actually available.
+    def RequestInputs(self, uint64_t bits):
+        return self.__matrix.RequestInputs(bits)
+
+    # Wait at most "timeout_ms" for any of the requested inputs to change
+    # (negative: forever, zero: return right away) and return the state of
+    # all inputs. The GIL is released while waiting.
+    def AwaitInputChange(self, int timeout_ms):
+        cdef cppinc.RGBMatrix* matrix = self.__matrix
+        cdef uint64_t inputs
+        with nogil:
+            inputs = matrix.AwaitInputChange(timeout_ms)
+        return inputs
+
+    # File descriptors to register with an event loop. Readable after a
+    # swap scheduled with ScheduleSwap() happened, or after the requested
+    # inputs changed, respectively; reading 8 bytes resets them.
+    # -1 if there is no refresh thread.
+    property vsync_fd:
+        def __get__(self): return self.__matrix.vsync_fd()
+
+    property input_fd:
+        def __get__(self): return self.__matrix.input_fd()
 
     property luminanceCorrect:
         def __get__(self): return self.__matrix.luminance_correct()
@@ -288,9 +382,125 @@ cdef class RGBMatrix(Canvas):
     property width:
         def __get__(self): return self.__matrix.width()
 
-cdef __createFrameCanvas(cppinc.FrameCanvas* newCanvas):
+# Pre-rendered content: frames are stored in the encoded form the matrix
+# shows them in, so playing them back is cheap. See content-streamer.h.
+
+cdef class StreamIO:
+    def __dealloc__(self):
+        del self._io
+
+# A stream in a file; "mode" is "r" to read or "w" to write it.
+cdef class FileStreamIO(StreamIO):
+    def __cinit__(self, filename, mode = "r"):
+        if mode == "r":
+            flags = os.O_RDONLY
+        elif mode == "w":
+            flags = os.O_CREAT | os.O_WRONLY | os.O_TRUNC
+        else:
+            raise ValueError("mode must be 'r' or 'w'")
+        self._io = new cppinc.FileStreamIO(os.open(filename, flags, 0o644))
+
+# A stream in a file, read-only and memory mapped. Faster to read than
+# FileStreamIO.
+cdef class MemMapViewInput(StreamIO):
+    def __cinit__(self, filename):
+        cdef cppinc.MemMapViewInput *input = new cppinc.MemMapViewInput(
+            os.open(filename, os.O_RDONLY))
+        self._io = input
+        if not input.IsInitialized():
+            raise OSError("Can't memory map %s" % filename)
+
+cdef class StreamWriter:
+    def __cinit__(self, StreamIO stream not None):
+        self._stream = stream
+        self._writer = new cppinc.StreamWriter(stream._io)
+
+    def __dealloc__(self):
+        del self._writer
+
+    # Append the frame, to be shown for "hold_time_us" microseconds.
+    # Returns success.
+    def Stream(self, FrameCanvas frame not None, uint32_t hold_time_us = 0):
+        cdef cppinc.FrameCanvas* canvas = <cppinc.FrameCanvas*>frame._getCanvas()
+        cdef bool success
+        with nogil:
+            success = self._writer.Stream(dereference(canvas), hold_time_us)
+        return success
+
+cdef class StreamReader:
+    def __cinit__(self, StreamIO stream not None):
+        self._stream = stream
+        self._reader = new cppinc.StreamReader(stream._io)
+
+    def __dealloc__(self):
+        del self._reader
+
+    def Rewind(self):
+        self._reader.Rewind()
+
+    # Read the next frame into "frame" and return for how many microseconds
+    # it is to be shown; None at the end of the stream.
+    def GetNext(self, FrameCanvas frame not None):
+        cdef cppinc.FrameCanvas* canvas = <cppinc.FrameCanvas*>frame._getCanvas()
+        cdef uint32_t hold_time_us
+        cdef bool success
+        with nogil:
+            success = self._reader.GetNext(canvas, &hold_time_us)
+        return hold_time_us if success else None
+
+# Plays streams on the matrix, each frame for the time stored with it. The
+# frames are read and shown natively, without the GIL, so playing is as fast
+# as with the C++ tools, and other Python threads keep running.
+cdef class StreamPlayer:
+    def __cinit__(self, RGBMatrix matrix not None, FrameCanvas canvas = None,
+                  int framerate_fraction = 1):
+        if canvas is None:
+            canvas = matrix.CreateFrameCanvas()
+        self._matrix = matrix
+        self._player = new cppinc.StreamPlayer(
+            <cppinc.RGBMatrix*>matrix._getCanvas(),
+            <cppinc.FrameCanvas*>canvas._getCanvas(), framerate_fraction)
+
+    def __dealloc__(self):
+        del self._player
+
+    # Play the stream "loops" times, or until Stop() is called if "loops"
+    # is negative. Returns the number of frames shown.
+    def Play(self, StreamReader reader not None, int loops = 1):
+        cdef cppinc.StreamPlayer* player = self._player
+        cdef cppinc.StreamReader* stream = reader._reader
+        cdef long frames = 0
+        cdef long frames_before
+        cdef bool at_end
+        self._stop = False
+        while loops != 0 and not self._stop:
+            frames_before = frames
+            at_end = False
+            while not at_end and not self._stop:
+                # Come back every now and then to see if we're interrupted.
+                with nogil:
+                    at_end = player.Play(stream, 100, &frames)
+                PyErr_CheckSignals()
+            if frames == frames_before:
+                break  # Empty or broken stream; don't spin.
+            reader.Rewind()
+            if loops > 0:
+                loops -= 1
+        return frames
+
+    # Make Play(), e.g. running in another thread, return soon.
+    def Stop(self):
+        self._stop = True
+
+    # The canvas not shown right now, to be used once done playing.
+    property canvas:
+        def __get__(self):
+            return __createFrameCanvas(self._player.canvas(), self._matrix)
+
+cdef __createFrameCanvas(cppinc.FrameCanvas* newCanvas, RGBMatrix owner):
     canvas = FrameCanvas()
     canvas.__canvas = newCanvas
+    canvas.__owner = owner
     return canvas
 
 # Local Variables:
@@ -1,5 +1,5 @@
 from libcpp cimport bool
-from libc.stdint cimport uint8_t, uint32_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t
 
 ########################
 ### External classes ###
@@ -10,6 +10,7 @@ cdef extern from "canvas.h" namespace "rgb_matrix":
         int width()
         int height()
         void SetPixel(int, int, uint8_t, uint8_t, uint8_t) nogil
+        void SetPixelBuffer(int, int, int, int, const uint8_t*, int, int, bool) nogil
         void Clear() nogil
         void Fill(uint8_t, uint8_t, uint8_t) nogil
 
@@ -22,7 +23,12 @@ cdef extern from "led-matrix.h" namespace "rgb_matrix":
         void SetBrightness(uint8_t)
         uint8_t brightness()
         FrameCanvas *CreateFrameCanvas()
-        FrameCanvas *SwapOnVSync(FrameCanvas*, uint8_t)
+        FrameCanvas *SwapOnVSync(FrameCanvas*, uint8_t) nogil
+        FrameCanvas *ScheduleSwap(FrameCanvas*, uint8_t)
+        int vsync_fd()
+        int input_fd()
+        uint64_t RequestInputs(uint64_t)
+        uint64_t AwaitInputChange(int) nogil
 
     cdef cppclass FrameCanvas(Canvas):
         bool SetPWMBits(uint8_t)
@@ -43,6 +49,31 @@ cdef extern from "led-matrix.h" namespace "rgb_matrix":
 
 
 
+cdef extern from "content-streamer.h" namespace "rgb_matrix":
+    cdef cppclass StreamIO:
+        pass
+
+    cdef cppclass FileStreamIO(StreamIO):
+        FileStreamIO(int)
+
+    cdef cppclass MemMapViewInput(StreamIO):
+        MemMapViewInput(int)
+        bool IsInitialized()
+
+    cdef cppclass StreamWriter:
+        StreamWriter(StreamIO*)
+        bool Stream(const FrameCanvas&, uint32_t) nogil
+
+    cdef cppclass StreamReader:
+        StreamReader(StreamIO*)
+        void Rewind()
+        bool GetNext(FrameCanvas*, uint32_t*) nogil
+
+    cdef cppclass StreamPlayer:
+        StreamPlayer(RGBMatrix*, FrameCanvas*, int)
+        bool Play(StreamReader*, int, long*) nogil
+        FrameCanvas *canvas()
+
 cdef extern from "led-matrix.h" namespace "rgb_matrix::RGBMatrix":
     cdef struct Options:
         Options() except +
@@ -83,8 +114,8 @@ cdef extern from "graphics.h" namespace "rgb_matrix":
         int height()
         int baseline()
         int CharacterWidth(uint32_t)
-        int DrawGlyph(Canvas*, int, int, const Color, uint32_t);
+        int DrawGlyph(Canvas*, int, int, const Color, uint32_t) nogil
 
-    cdef int DrawText(Canvas*, const Font, int, int, const Color, const char*)
-    cdef void DrawCircle(Canvas*, int, int, int, const Color)
-    cdef void DrawLine(Canvas*, int, int, int, int, const Color)
+    cdef int DrawText(Canvas*, const Font, int, int, const Color, const char*) nogil
+    cdef void DrawCircle(Canvas*, int, int, int, const Color) nogil
+    cdef void DrawLine(Canvas*, int, int, int, int, const Color) nogil
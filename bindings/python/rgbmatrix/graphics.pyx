@@ -32,7 +32,12 @@ cdef class Font:
             raise Exception("Couldn't load font " + file)
 
     def DrawGlyph(self, core.Canvas c, int x, int y, Color color, uint32_t char):
-        return self.__font.DrawGlyph(c._getCanvas(), x, y, color.__color, char)
+        cdef cppinc.Canvas* canvas = c._getCanvas()
+        cdef cppinc.Color glyph_color = color.__color
+        cdef int advance
+        with nogil:
+            advance = self.__font.DrawGlyph(canvas, x, y, glyph_color, char)
+        return advance
 
     property height:
         def __get__(self): return self.__font.height()
@@ -40,14 +45,31 @@ cdef class Font:
     property baseline:
         def __get__(self): return self.__font.baseline()
 
+# The drawing functions release the GIL while drawing. The arguments stay
+# referenced by the caller until they return, so the canvas and the font
+# can't go away in the meantime; the color is copied.
+
 def DrawText(core.Canvas c, Font f, int x, int y, Color color, text):
-    return cppinc.DrawText(c._getCanvas(), f.__font, x, y, color.__color, text.encode('utf-8'))
+    cdef cppinc.Canvas* canvas = c._getCanvas()
+    cdef cppinc.Color text_color = color.__color
+    cdef bytes utf8_text = text.encode('utf-8')   # Keeps the bytes alive.
+    cdef const char *utf8 = utf8_text
+    cdef int advance
+    with nogil:
+        advance = cppinc.DrawText(canvas, f.__font, x, y, text_color, utf8)
+    return advance
 
 def DrawCircle(core.Canvas c, int x, int y, int r, Color color):
-    cppinc.DrawCircle(c._getCanvas(), x, y, r, color.__color)
+    cdef cppinc.Canvas* canvas = c._getCanvas()
+    cdef cppinc.Color circle_color = color.__color
+    with nogil:
+        cppinc.DrawCircle(canvas, x, y, r, circle_color)
 
 def DrawLine(core.Canvas c, int x1, int y1, int x2, int y2, Color color):
-    cppinc.DrawLine(c._getCanvas(), x1, y1, x2, y2, color.__color)
+    cdef cppinc.Canvas* canvas = c._getCanvas()
+    cdef cppinc.Color line_color = color.__color
+    with nogil:
+        cppinc.DrawLine(canvas, x1, y1, x2, y2, line_color)
 
 # Local Variables:
 # mode: python
@@ -9,6 +9,7 @@
 
 #include "pixel-mapper.h"
 #include "graphics.h"
+#include "draw-context.h"
 
 #include <assert.h>
 #include <getopt.h>
@@ -112,6 +113,8 @@ private:
     // get center of the matrix
     const int cx = canvas()->width()/2;
     const int cy = canvas()->height()/2; 
+    DrawContext context(canvas());
+    const Color color(r, g, b);
 
     // for every edge
     for (int i=0;i<edgeCnt*2;i+=2){
@@ -127,7 +130,7 @@ private:
         zpoints[j] = z*f;
       }
 
-      DrawLine(canvas(), cx+xpoints[0], cy+zpoints[0], cx+xpoints[1], cy+zpoints[1], Color(r, g, b));
+      context.DrawLine(cx+xpoints[0], cy+zpoints[0], cx+xpoints[1], cy+zpoints[1], color);
     }
   }
 
@@ -925,35 +928,28 @@ public:
       }
 
       for (int i=0; i<numBars_; ++i) {
-        int y;
-        for (y=0; y<barHeights_[i]; ++y) {
-          if (y<heightGreen_) {
-            drawBarRow(i, y, 0, 200, 0);
-          }
-          else if (y<heightYellow_) {
-            drawBarRow(i, y, 150, 150, 0);
-          }
-          else if (y<heightOrange_) {
-            drawBarRow(i, y, 250, 100, 0);
-          }
-          else {
-            drawBarRow(i, y, 200, 0, 0);
-          }
-        }
+        const int h = min(barHeights_[i], height_);
+        // Each color section of the bar is one rectangle.
+        drawBarSection(i, 0, min(h, heightGreen_), Color(0, 200, 0));
+        drawBarSection(i, heightGreen_, min(h, heightYellow_),
+                       Color(150, 150, 0));
+        drawBarSection(i, heightYellow_, min(h, heightOrange_),
+                       Color(250, 100, 0));
+        drawBarSection(i, heightOrange_, h, Color(200, 0, 0));
         // Anything above the bar should be black
-        for (; y<height_; ++y) {
-          drawBarRow(i, y, 0, 0, 0);
-        }
+        drawBarSection(i, max(h, 0), height_, Color(0, 0, 0));
       }
       usleep(delay_ms_ * 1000);
     }
   }
 
 private:
-  void drawBarRow(int bar, int y, uint8_t r, uint8_t g, uint8_t b) {
-    for (int x=bar*barWidth_; x<(bar+1)*barWidth_; ++x) {
-      canvas()->SetPixel(x, height_-1-y, r, g, b);
-    }
+  // Draw rows "y_from" (inclusive) to "y_to" (exclusive) of a bar, counted
+  // from the bottom.
+  void drawBarSection(int bar, int y_from, int y_to, const Color &color) {
+    if (y_to <= y_from) return;
+    DrawContext(canvas()).FillRect(bar*barWidth_, height_-y_to,
+                                   barWidth_, y_to-y_from, color);
   }
 
   int delay_ms_;
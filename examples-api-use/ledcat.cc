@@ -1,82 +1,390 @@
 // -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
-// A program that reads frames form STDIN as RGB24, much like
-// https://github.com/polyfloyd/ledcat does.
+// A program that reads raw frames from STDIN, a UNIX socket or UDP and
+// shows them, much like https://github.com/polyfloyd/ledcat does.
+//
+// Frames are read in a separate thread into one of three buffers; the
+// display always shows the latest complete frame, so if frames arrive
+// faster than the matrix can show them, the old ones are skipped instead
+// of adding latency. Frames are shown with SwapOnVSync(), so there is no
+// tearing.
 //
 // This code is public domain
 // (but note, that the led-matrix library this depends on is GPL v2)
 
 #include "led-matrix.h"
+#include "graphics.h"
+#include "thread.h"
 
-#include <math.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-#define FPS 60
+#include <algorithm>
+#include <vector>
 
+using rgb_matrix::Color;
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::Mutex;
+using rgb_matrix::MutexLock;
 using rgb_matrix::RGBMatrix;
-using rgb_matrix::Canvas;
 
 volatile bool interrupt_received = false;
 static void InterruptHandler(int signo) {
   interrupt_received = true;
 }
 
+// How long blocking calls wait before checking for an interrupt.
+static const int kPollTimeoutMs = 100;
+
+enum PixelFormat {
+  RGB24, BGR24, RGBX32, BGRX32, RGB565, GRAY8
+};
+
+static const struct {
+  const char *name;
+  PixelFormat format;
+  int bytes_per_pixel;
+} kPixelFormats[] = {
+  { "rgb24",  RGB24,  3 },
+  { "bgr24",  BGR24,  3 },
+  { "rgbx32", RGBX32, 4 },   // Also RGBA; alpha is ignored.
+  { "bgrx32", BGRX32, 4 },
+  { "rgb565", RGB565, 2 },   // Little endian.
+  { "gray8",  GRAY8,  1 },
+};
+
+// Convert a row of "width" pixels in "format" to RGB.
+static void ConvertRow(PixelFormat format, const uint8_t *in, int width,
+                       Color *out) {
+  for (int x = 0; x < width; ++x) {
+    switch (format) {
+    case RGB24:  out[x] = Color(in[0], in[1], in[2]); in += 3; break;
+    case BGR24:  out[x] = Color(in[2], in[1], in[0]); in += 3; break;
+    case RGBX32: out[x] = Color(in[0], in[1], in[2]); in += 4; break;
+    case BGRX32: out[x] = Color(in[2], in[1], in[0]); in += 4; break;
+    case RGB565: {
+      const int v = in[0] | (in[1] << 8);
+      const int r = (v >> 11) & 0x1f, g = (v >> 5) & 0x3f, b = v & 0x1f;
+      out[x] = Color((r << 3) | (r >> 2), (g << 2) | (g >> 4),
+                     (b << 3) | (b >> 2));
+      in += 2;
+      break;
+    }
+    case GRAY8:  out[x] = Color(in[0], in[0], in[0]); in += 1; break;
+    }
+  }
+}
+
+// Three frame buffers between reader and display: one being written, one
+// being shown, and the latest complete frame. Publishing a new frame
+// replaces the latest frame if it was not taken yet.
+class FrameExchange {
+public:
+  explicit FrameExchange(size_t frame_size)
+    : write_(0), latest_(1), read_(2), fresh_(false), closed_(false),
+      received_(0), skipped_(0) {
+    for (int i = 0; i < 3; ++i) buffers_[i].resize(frame_size);
+    pthread_cond_init(&cond_, NULL);
+  }
+  ~FrameExchange() { pthread_cond_destroy(&cond_); }
+
+  // -- Reader side.
+  uint8_t *write_buffer() { return buffers_[write_].data(); }
+
+  // The write buffer now contains a complete frame.
+  void Publish() {
+    MutexLock l(&mutex_);
+    std::swap(write_, latest_);
+    if (fresh_) ++skipped_;
+    fresh_ = true;
+    ++received_;
+    pthread_cond_signal(&cond_);
+  }
+
+  // No more frames will come.
+  void Close() {
+    MutexLock l(&mutex_);
+    closed_ = true;
+    pthread_cond_signal(&cond_);
+  }
+
+  // -- Display side.
+
+  // Returns the latest frame not seen yet, or NULL if there is none after
+  // "timeout_ms". Valid until the next call.
+  const uint8_t *Take(long timeout_ms) {
+    MutexLock l(&mutex_);
+    if (!fresh_ && !closed_) mutex_.WaitOn(&cond_, timeout_ms);
+    if (!fresh_) return NULL;
+    std::swap(read_, latest_);
+    fresh_ = false;
+    return buffers_[read_].data();
+  }
+
+  bool closed() {
+    MutexLock l(&mutex_);
+    return closed_ && !fresh_;
+  }
+
+  void GetStats(long *received, long *skipped) {
+    MutexLock l(&mutex_);
+    *received = received_;
+    *skipped = skipped_;
+  }
+
+private:
+  std::vector<uint8_t> buffers_[3];
+  int write_, latest_, read_;
+  bool fresh_;
+  bool closed_;
+  long received_, skipped_;
+  Mutex mutex_;
+  pthread_cond_t cond_;
+};
+
+// Wait until "fd" is readable. Returns false on interrupt or error.
+static bool WaitReadable(int fd) {
+  while (!interrupt_received) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    const int result = poll(&p, 1, kPollTimeoutMs);
+    if (result > 0) return true;
+    if (result < 0 && errno != EINTR) return false;
+  }
+  return false;
+}
+
+// Read exactly "size" bytes. Returns false on end of input.
+static bool ReadFully(int fd, uint8_t *buffer, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    if (!WaitReadable(fd)) return false;
+    const ssize_t r = read(fd, buffer + total, size - total);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    total += r;
+  }
+  return true;
+}
+
+// Reads frames from the input and publishes them in the exchange.
+class FrameReader : public rgb_matrix::Thread {
+public:
+  enum Source { STREAM, UNIX_LISTEN, UDP };
+
+  FrameReader(Source source, int fd, FrameExchange *exchange,
+              size_t frame_size)
+    : source_(source), fd_(fd), exchange_(exchange),
+      frame_size_(frame_size) {}
+
+  virtual void Run() {
+    switch (source_) {
+    case STREAM:
+      while (ReadFully(fd_, exchange_->write_buffer(), frame_size_)) {
+        exchange_->Publish();
+      }
+      break;
+
+    case UNIX_LISTEN:
+      // One client at a time; when it disconnects, wait for the next.
+      while (WaitReadable(fd_)) {
+        const int client = accept(fd_, NULL, NULL);
+        if (client < 0) continue;
+        while (ReadFully(client, exchange_->write_buffer(), frame_size_)) {
+          exchange_->Publish();
+        }
+        close(client);
+      }
+      break;
+
+    case UDP:
+      // Each datagram is one frame.
+      while (WaitReadable(fd_)) {
+        const ssize_t r = recv(fd_, exchange_->write_buffer(), frame_size_,
+                               MSG_TRUNC);
+        if (r == (ssize_t)frame_size_) {
+          exchange_->Publish();
+        } else if (r >= 0) {
+          fprintf(stderr, "Ignoring datagram of %d bytes; expected %d.\n",
+                  (int)r, (int)frame_size_);
+        }
+      }
+      break;
+    }
+    exchange_->Close();
+  }
+
+private:
+  const Source source_;
+  const int fd_;
+  FrameExchange *const exchange_;
+  const size_t frame_size_;
+};
+
+static int OpenUnixSocket(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);  // Left over from a previous run.
+  if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(fd, 1) < 0) {
+    perror("Can't listen on UNIX socket");
+    return -1;
+  }
+  return fd;
+}
+
+static int OpenUDPSocket(int port, size_t frame_size) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("Can't bind UDP socket");
+    return -1;
+  }
+  // Room for a few frames, in case we're busy for a moment.
+  int buffer_size = 4 * frame_size;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  return fd;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Reads raw frames of the size of the display and shows "
+          "them.\nOptions:\n"
+          "\t-i <input>  : Where to read frames from. Default '-'\n"
+          "\t              -            : stdin; e.g. a pipe\n"
+          "\t              unix:<path>  : UNIX socket to listen on\n"
+          "\t              udp:<port>   : UDP port; one frame per datagram\n"
+          "\t-f <format> : Pixel format. Default rgb24. One of\n"
+          "\t              ");
+  for (size_t i = 0; i < sizeof(kPixelFormats)/sizeof(kPixelFormats[0]); ++i)
+    fprintf(stderr, "%s ", kPixelFormats[i].name);
+  fprintf(stderr, "\n\t-v          : Print statistics at the end.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options defaults;
   defaults.hardware_mapping = "regular"; // or e.g. "adafruit-hat"
   defaults.rows = 32;
   defaults.chain_length = 1;
   defaults.parallel = 1;
-  Canvas *canvas = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
-  if (canvas == NULL) {
-    return 1;
+  RGBMatrix *matrix = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
+  if (matrix == NULL) {
+    return usage(argv[0]);
   }
 
+  const char *input = "-";
+  const char *format_name = "rgb24";
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "i:f:v")) != -1) {
+    switch (opt) {
+    case 'i': input = optarg; break;
+    case 'f': format_name = optarg; break;
+    case 'v': verbose = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  int format_index = -1;
+  for (size_t i = 0; i < sizeof(kPixelFormats)/sizeof(kPixelFormats[0]); ++i) {
+    if (strcmp(format_name, kPixelFormats[i].name) == 0) format_index = i;
+  }
+  if (format_index < 0) {
+    fprintf(stderr, "Unknown pixel format '%s'\n", format_name);
+    return usage(argv[0]);
+  }
+  const PixelFormat format = kPixelFormats[format_index].format;
+  const int width = matrix->width();
+  const int height = matrix->height();
+  const size_t row_size = (size_t)width * kPixelFormats[format_index].bytes_per_pixel;
+  const size_t frame_size = row_size * height;
+
+  FrameReader::Source source;
+  int fd;
+  if (strcmp(input, "-") == 0) {
+    source = FrameReader::STREAM;
+    fd = STDIN_FILENO;
+  } else if (strncmp(input, "unix:", 5) == 0) {
+    source = FrameReader::UNIX_LISTEN;
+    fd = OpenUnixSocket(input + 5);
+  } else if (strncmp(input, "udp:", 4) == 0) {
+    source = FrameReader::UDP;
+    if (frame_size > 65507) {
+      fprintf(stderr, "Frames of %d bytes don't fit in a UDP datagram.\n",
+              (int)frame_size);
+      return 1;
+    }
+    fd = OpenUDPSocket(atoi(input + 4), frame_size);
+  } else {
+    fprintf(stderr, "Unknown input '%s'\n", input);
+    return usage(argv[0]);
+  }
+  if (fd < 0) return 1;
+
   // It is always good to set up a signal handler to cleanly exit when we
-  // receive a CTRL-C for instance. The DrawOnCanvas() routine is looking
-  // for that.
+  // receive a CTRL-C for instance.
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT, InterruptHandler);
 
-  ssize_t frame_size = (ssize_t)canvas->width() * (ssize_t)canvas->height() * 3;
-  uint8_t buf[frame_size];
+  FrameExchange exchange(frame_size);
+  FrameReader reader(source, fd, &exchange, frame_size);
+  reader.Start();
 
-  while (1) {
-    struct timespec start;
-    timespec_get(&start, TIME_UTC);
-
-    ssize_t nread;
-    ssize_t total_nread = 0;
-    while ((nread = read(STDIN_FILENO, &buf[total_nread], frame_size - total_nread)) > 0) {
-      if (interrupt_received) {
-        return 1;
-      }
-      total_nread += nread;
-    }
-    if (total_nread < frame_size){
-      break;
-    }
-
-    for (int y = 0; y < canvas->height(); y++) {
-      for (int x = 0; x < canvas->width(); x++) {
-        uint8_t *p = &buf[(y * canvas->width() + x) * 3];
-        uint8_t r = *(p+0), g = *(p+1), b = *(p+2);
-        canvas->SetPixel(x, y, r, g, b);
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  std::vector<Color> row(width);
+  long shown = 0;
+  while (!interrupt_received && !exchange.closed()) {
+    const uint8_t *frame = exchange.Take(kPollTimeoutMs);
+    if (frame == NULL) continue;
+    for (int y = 0; y < height; ++y) {
+      const uint8_t *in = frame + y * row_size;
+      if (format == RGB24) {
+        // Same layout as Color: no need to convert.
+        offscreen->SetPixels(0, y, width, 1, (Color*)in);
+      } else {
+        ConvertRow(format, in, width, row.data());
+        offscreen->SetPixels(0, y, width, 1, row.data());
       }
     }
+    offscreen = matrix->SwapOnVSync(offscreen);
+    ++shown;
+  }
+  reader.WaitStopped();
 
-    struct timespec end;
-    timespec_get(&end, TIME_UTC);
-    long tudiff = (end.tv_nsec / 1000 + end.tv_sec * 1000000) - (start.tv_nsec / 1000 + start.tv_sec * 1000000);
-    if (tudiff < 1000000l / FPS) {
-      usleep(1000000l / FPS - tudiff);
-    }
+  if (verbose) {
+    long received, skipped;
+    exchange.GetStats(&received, &skipped);
+    fprintf(stderr, "%ld frames received, %ld shown, %ld skipped.\n",
+            received, shown, skipped);
   }
 
+  if (source == FrameReader::UNIX_LISTEN) unlink(input + 5);
+
   // Animation finished. Shut down the RGB matrix.
-  canvas->Clear();
-  delete canvas;
+  matrix->Clear();
+  delete matrix;
   return 0;
 }
@@ -46,6 +46,46 @@ public:
 
   // Fill screen with given 24bpp color.
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) = 0;
+
+  // Fill the rectangle of "width" x "height" pixels starting at (x,y) with
+  // the given color. Parts outside the canvas are clipped.
+  //
+  // The default implementation just calls SetPixel() for each pixel;
+  // implementations that can write whole spans at once (such as the
+  // FrameCanvas) override this. Text and graphics primitives use this to
+  // emit horizontal runs instead of single pixels.
+  virtual void SubFill(int x, int y, int width, int height,
+                       uint8_t red, uint8_t green, uint8_t blue) {
+    const int x_end = (x + width < this->width()) ? x + width : this->width();
+    const int y_end = (y + height < this->height()) ? y + height : this->height();
+    for (int yy = (y < 0) ? 0 : y; yy < y_end; ++yy) {
+      for (int xx = (x < 0) ? 0 : x; xx < x_end; ++xx) {
+        SetPixel(xx, yy, red, green, blue);
+      }
+    }
+  }
+
+  // Copy an image of "width" x "height" pixels in memory to (x,y). Pixels
+  // are "pixel_step" bytes apart and start with red, green and blue, or
+  // blue, green and red if "is_bgr" (so 3 for RGB, 4 for RGBA; other bytes
+  // such as alpha are ignored). Rows are "stride" bytes apart. Parts outside
+  // the canvas are clipped.
+  //
+  // The default implementation just calls SetPixel() for each pixel; the
+  // FrameCanvas writes whole rows at once.
+  virtual void SetPixelBuffer(int x, int y, int width, int height,
+                              const uint8_t *pixels, int pixel_step,
+                              int stride, bool is_bgr) {
+    const int r = is_bgr ? 2 : 0;
+    const int b = is_bgr ? 0 : 2;
+    for (int row = (y < 0) ? -y : 0; row < height; ++row) {
+      if (y + row >= this->height()) break;
+      const uint8_t *pixel = pixels + (long)row * stride;
+      for (int col = 0; col < width; ++col, pixel += pixel_step) {
+        SetPixel(x + col, y + row, pixel[r], pixel[1], pixel[b]);
+      }
+    }
+  }
 };
 
 }  // namespace rgb_matrix
@@ -0,0 +1,146 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Alpha-blending of several layers into a canvas, e.g. a video with a
+// ticker and a clock on top.
+//
+// Each Layer is an RGBA image with a position and an opacity. The
+// Compositor blends all layers bottom to top over a background color into a
+// shadow buffer and copies the result onto the target canvas. Only the
+// area that changed since a target was last composed onto is re-blended and
+// copied, so static layers cost nothing while a small overlay changes.
+
+#ifndef RPI_COMPOSITOR_H
+#define RPI_COMPOSITOR_H
+
+#include "canvas.h"
+#include "graphics.h"
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+namespace rgb_matrix {
+class Compositor;
+class FrameCanvas;
+
+// A layer of the compositor. All Canvas functions draw opaque pixels, so
+// text and graphics can be drawn onto a layer as on any other canvas;
+// transparency comes from Clear(), SetPixelRGBA() and SetImage().
+class Layer : public Canvas {
+public:
+  // Rectangle of pixels [x0, x1) x [y0, y1).
+  struct Rect {
+    Rect() : x0(0), y0(0), x1(0), y1(0) {}
+    Rect(int xx0, int yy0, int xx1, int yy1)
+      : x0(xx0), y0(yy0), x1(xx1), y1(yy1) {}
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    void Add(const Rect &other);        // Extend to the bounding box.
+    Rect Intersect(const Rect &other) const;
+    int x0, y0, x1, y1;
+  };
+
+  // Position of the top left corner on the compositor; may be negative or
+  // beyond the edges, the layer is clipped.
+  void SetPosition(int x, int y);
+  int x() const { return x_; }
+  int y() const { return y_; }
+
+  // Opacity of the whole layer, multiplied with the alpha of each pixel.
+  // 0 is invisible, 255 (the default) fully opaque.
+  void SetOpacity(uint8_t opacity);
+  uint8_t opacity() const { return opacity_; }
+
+  void SetVisible(bool visible);
+  bool visible() const { return visible_; }
+
+  void SetPixelRGBA(int x, int y,
+                    uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
+
+  // Copy an RGBA image of "width" x "height" pixels to "x","y" of this
+  // layer. Rows in "rgba" are "stride" bytes apart.
+  void SetImage(int x, int y, const uint8_t *rgba,
+                int width, int height, int stride);
+
+  // -- Canvas interface. Clear() makes the layer fully transparent.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SubFill(int x, int y, int width, int height,
+                       uint8_t red, uint8_t green, uint8_t blue);
+
+private:
+  friend class Compositor;
+  struct Pixel {
+    uint8_t r, g, b, a;
+  };
+
+  Layer(int width, int height);
+  Layer(const Layer &);  // No copy.
+
+  void FillRGBA(int x, int y, int width, int height, const Pixel &p);
+  Rect ScreenRect() const { return Rect(x_, y_, x_ + width_, y_ + height_); }
+
+  const int width_;
+  const int height_;
+  std::vector<Pixel> pixels_;
+  int x_, y_;
+  uint8_t opacity_;
+  bool visible_;
+
+  // Changes since the last composition.
+  Rect dirty_;             // Content changes, in layer coordinates.
+  bool placement_changed_; // Position, opacity or visibility.
+  Rect composed_rect_;     // Where the layer was shown last time.
+};
+
+class Compositor {
+public:
+  // Compositor of the given size, typically that of the display.
+  Compositor(int width, int height);
+  ~Compositor();
+
+  // Add a new, transparent layer on top of all others. The layer is owned
+  // by the compositor.
+  Layer *AddLayer(int width, int height);
+
+  // Remove and delete the layer.
+  void RemoveLayer(Layer *layer);
+
+  // Color below all layers. Default black.
+  void SetBackground(const Color &color);
+
+  // Re-compose everything on the next call to Compose().
+  void Invalidate();
+
+  // Blend the changed parts of all layers and copy to "target". Only the
+  // area that changed since the last Compose() onto the same "target" is
+  // written, so this works with the alternating canvases of
+  // RGBMatrix::SwapOnVSync(). The FrameCanvas variant writes whole rows
+  // at once and is preferable.
+  void Compose(FrameCanvas *target);
+  void Compose(Canvas *target);
+
+private:
+  Compositor(const Compositor &);  // No copy.
+
+  void Update();                       // Collect changes, re-blend them.
+  Layer::Rect TakeTargetRect(const Canvas *target);
+  void BlendRegion(const Layer::Rect &region);
+
+  const int width_;
+  const int height_;
+  Color background_;
+  Layer::Rect changed_;                // Not yet re-blended.
+  std::vector<Layer*> layers_;         // Bottom to top.
+  std::vector<Color> composed_;        // Result of blending all layers.
+
+  // For each target we composed onto, the region it is not up-to-date in.
+  std::map<const Canvas*, Layer::Rect> target_dirty_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_COMPOSITOR_H
@@ -11,6 +11,11 @@
 // These abstractions are used in util/led-image-viewer.cc to read and
 // write such animations to disk. It is also used in util/video-viewer.cc
 // to write a version to disk that then can be played with the led-image-viewer.
+//
+// A StreamCache keeps such streams in a directory, keyed by the content of
+// the file they were rendered from and all the settings that change the
+// rendering. Both tools use it to skip decoding and scaling when showing
+// the same file again.
 
 #ifndef RPI_CONTENT_STREAMER_H
 #define RPI_CONTENT_STREAMER_H
@@ -21,8 +26,9 @@
 
 #include <string>
 
+#include "led-matrix.h"
+
 namespace rgb_matrix {
-class FrameCanvas;
 
 // An abstraction of a data stream. Two implementations exist for files and
 // an in-memory representation, but this allows your own implementation, e.g.
@@ -132,6 +138,96 @@ private:
 
   char *header_frame_buffer_;
 };
+
+// Plays a stream on the matrix, every frame for the hold time stored with
+// it. Playing runs entirely in the library, with no per-frame work left to
+// the caller, e.g. a program using the Python bindings.
+class StreamPlayer {
+public:
+  // Does not take ownership of the matrix. Frames are read into "canvas"
+  // (created with matrix->CreateFrameCanvas()), which is swapped with the
+  // one shown, at multiples of "vsync_multiple" refreshes.
+  StreamPlayer(RGBMatrix *matrix, FrameCanvas *canvas, int vsync_multiple = 1);
+
+  // Show the frames of "reader" until the end of the stream, or until
+  // "timeout_ms" passed if it is not negative. Returns true if the end of
+  // the stream (or an error) was reached, false on timeout. If
+  // "frame_count" is not NULL, it is incremented for every frame shown.
+  //
+  // Calling it again continues with the timing of the frame shown last, so
+  // playback can be split into several calls, e.g. to react on something
+  // in between, or to loop after rewinding the reader.
+  bool Play(StreamReader *reader, int timeout_ms = -1,
+            long *frame_count = NULL);
+
+  // The canvas not shown right now; use it once done playing.
+  FrameCanvas *canvas() const { return canvas_; }
+
+private:
+  RGBMatrix *const matrix_;
+  FrameCanvas *canvas_;
+  const int vsync_multiple_;
+  int64_t next_frame_nanos_;   // When the frame shown should be replaced.
+};
+
+// A stream being written into a StreamCache; use it with a StreamWriter.
+// It only shows up in the cache once committed, so streams that were
+// interrupted while rendering are never used.
+class StreamCacheEntry : public StreamIO {
+public:
+  ~StreamCacheEntry();  // Discards the stream if not committed.
+
+  // Make the stream available in the cache. Returns success; fails, and
+  // discards the stream, if anything could not be written completely.
+  bool Commit();
+
+  void Rewind() final;
+  ssize_t Read(void *buf, size_t count) final;
+  ssize_t Append(const void *buf, size_t count) final;
+
+private:
+  friend class StreamCache;
+  StreamCacheEntry(const std::string &path, const std::string &temp_path,
+                   int fd);
+
+  const std::string path_;
+  const std::string temp_path_;
+  FileStreamIO *io_;
+  bool write_failed_;   // Some Append() failed or was short.
+};
+
+// Directory of streams rendered from other files, e.g. images or videos.
+// Streams are looked up by a key describing the source and how it was
+// rendered; see MakeKey().
+class StreamCache {
+public:
+  // The directory is created if it doesn't exist yet.
+  explicit StreamCache(const std::string &directory);
+
+  // Key for "filename" rendered for a matrix with "options". The file is
+  // identified by its size, modification time and its first and last
+  // megabyte, so this is cheap even for large files. The
+  // "tool_options" describe everything else that changes the rendering,
+  // e.g. scaling or timing choices of the program.
+  // Returns an empty string if the file can't be read.
+  static std::string MakeKey(const char *filename,
+                             const RGBMatrix::Options &options,
+                             const std::string &tool_options);
+
+  // Open the stream stored for "key", memory mapped if "do_mmap" and
+  // possible. Returns NULL if there is none.
+  StreamIO *Open(const std::string &key, bool do_mmap = true) const;
+
+  // Start writing the stream for "key". Returns NULL if it can't be
+  // created. The caller owns the entry; it only replaces an existing
+  // stream when committed.
+  StreamCacheEntry *CreateEntry(const std::string &key) const;
+
+private:
+  std::string Path(const std::string &key) const;
+
+  const std::string directory_;
+};
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Drawing of lines, rectangles, circles and polygons on a Canvas.
+//
+// All primitives are clipped once against the clip rectangle before any
+// pixel is touched, and are written as horizontal or vertical spans with
+// Canvas::SubFill(), which a FrameCanvas writes directly into its internal
+// bitplanes. So parts outside the canvas cost nothing, and the cost of the
+// visible part is mostly per span instead of per pixel.
+
+#ifndef RPI_DRAW_CONTEXT_H
+#define RPI_DRAW_CONTEXT_H
+
+#include "canvas.h"
+#include "graphics.h"
+
+#include <vector>
+
+namespace rgb_matrix {
+
+struct Point {
+  Point() : x(0), y(0) {}
+  Point(int xx, int yy) : x(xx), y(yy) {}
+  int x;
+  int y;
+};
+
+class DrawContext {
+public:
+  // Create a context to draw on "canvas", clipping to the full canvas.
+  // The canvas is not owned and needs to outlive the context.
+  explicit DrawContext(Canvas *canvas);
+
+  // Restrict drawing to the given rectangle (intersected with the canvas).
+  void SetClipRect(int x, int y, int width, int height);
+  void ResetClipRect();
+
+  void SetPixel(int x, int y, const Color &color);
+
+  // Line from "x0","y0" to "x1","y1", both ends inclusive. Pixels are the
+  // same as with the DrawLine() function in graphics.h.
+  void DrawLine(int x0, int y0, int x1, int y1, const Color &color);
+
+  // Line of the given "thickness" in pixels, centered on the line between
+  // the points. A thickness of 1 or less is the same as DrawLine().
+  void DrawThickLine(int x0, int y0, int x1, int y1, int thickness,
+                     const Color &color);
+
+  // Connect "count" points with lines; if "closed", also the last with the
+  // first point.
+  void DrawPolyline(const Point *points, int count, bool closed,
+                    const Color &color, int thickness = 1);
+
+  // Outline or filled rectangle with top left corner "x","y".
+  void DrawRect(int x, int y, int width, int height, const Color &color);
+  void FillRect(int x, int y, int width, int height, const Color &color);
+
+  // Circle centered at "x","y". The outline is the same as with the
+  // DrawCircle() function in graphics.h.
+  void DrawCircle(int x, int y, int radius, const Color &color);
+  void FillCircle(int x, int y, int radius, const Color &color);
+
+  // Fill a polygon with "count" corners (even-odd rule, so
+  // self-intersecting polygons have holes). Pixels are filled if their
+  // center is inside. Corners are at pixel corners, so the polygon
+  // (0,0) (3,0) (3,3) (0,3) fills the same pixels as FillRect(0, 0, 3, 3).
+  void FillPolygon(const Point *points, int count, const Color &color);
+
+private:
+  struct Vertex {
+    double x, y;
+  };
+
+  // Horizontal span from x0 to x1 inclusive in row "y"; clipped.
+  void HorizontalSpan(int x0, int x1, int y, const Color &color);
+  // Vertical span from y0 to y1 inclusive in column "x"; clipped.
+  void VerticalSpan(int x, int y0, int y1, const Color &color);
+  void FillVertices(const Vertex *vertices, int count, const Color &color);
+
+  Canvas *const canvas_;
+
+  // Clip rectangle, inclusive.
+  int clip_x0_, clip_y0_, clip_x1_, clip_y1_;
+
+  std::vector<Vertex> vertices_;     // Scratch space for polygons.
+  std::vector<double> crossings_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_DRAW_CONTEXT_H
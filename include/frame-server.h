@@ -0,0 +1,124 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Handing frames from several processes to the one process driving the
+// matrix, through shared memory.
+//
+// Only one process can own the GPIO, so normally every content source needs
+// to be part of that program. With a FrameServer, the process driving the
+// matrix (see utils/frame-server.cc) creates a named shared memory area with
+// a number of channels. Other processes attach to it with a FrameProducer,
+// draw into a frame buffer in the shared memory and submit it; nothing is
+// copied or serialized on the way. Channels are shown on top of each other,
+// with transparency, higher channel numbers on top.
+//
+// If a producer exits or crashes, its channel is released and disappears
+// from the display; the display itself keeps running.
+
+#ifndef RPI_FRAME_SERVER_H
+#define RPI_FRAME_SERVER_H
+
+#include "canvas.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace rgb_matrix {
+namespace internal {
+struct SharedFrameHeader;
+struct SharedFrameChannel;
+}
+
+// The matrix side. Creates the shared memory and takes the submitted frames.
+class FrameServer {
+public:
+  // Create shared memory with the given "name" (e.g. "/rgbmatrix") for
+  // frames of "width" x "height" RGBA pixels, with "channels" channels.
+  // Returns NULL on failure, after printing the reason to stderr.
+  static FrameServer *Create(const char *name, int width, int height,
+                             int channels);
+  ~FrameServer();   // Removes the shared memory.
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int channels() const { return channels_; }
+
+  // Wait until a producer submits a frame, at most "timeout_ms". Frames
+  // left behind by producers that released their channel don't count.
+  void WaitForFrames(int timeout_ms);
+
+  // If there is a new frame in "channel" since the last call, make
+  // "*rgba" point to it and return true. The frame has width() x height()
+  // pixels, 4 bytes each, and stays valid until the next TakeFrame() for
+  // the same channel. The last frame of a producer that has released the
+  // channel can still be taken.
+  bool TakeFrame(int channel, const uint8_t **rgba);
+
+  // Returns true if a producer is attached to "channel". Channels of
+  // producers that died are released here.
+  bool IsActive(int channel);
+
+private:
+  FrameServer(const std::string &name, int width, int height, int channels,
+              void *memory, size_t size);
+
+  internal::SharedFrameChannel *channel(int c);
+  uint8_t *buffer(int c, int index);
+
+  // Set up the buffers of channel "c" not shown afresh.
+  void ResetChannel(int c);
+
+  const std::string name_;
+  const int width_, height_, channels_;
+  const size_t frame_size_;     // Bytes per buffer.
+  void *const memory_;
+  const size_t size_;
+  internal::SharedFrameHeader *const header_;
+  std::vector<int> front_;      // Per channel: buffer currently taken.
+};
+
+// The producer side. Draw into the frame, then Submit() it. As a Canvas,
+// all drawing functions of the library can be used; their pixels are
+// opaque, while Clear() makes the frame transparent.
+class FrameProducer : public Canvas {
+public:
+  // Attach to the shared memory "name" created by a FrameServer, using
+  // "channel", or the first free one if "channel" is -1.
+  // Returns NULL on failure, after printing the reason to stderr.
+  static FrameProducer *Connect(const char *name, int channel = -1);
+  virtual ~FrameProducer();   // Releases the channel.
+
+  int channel() const { return channel_; }
+
+  // The frame to draw into: width() x height() pixels with 4 bytes each:
+  // red, green, blue, alpha. After Submit(), this is a different buffer
+  // with an older frame in it.
+  uint8_t *frame() { return frame_; }
+
+  // Show the frame; the last submitted frame wins if the display is
+  // slower than the producer.
+  void Submit();
+
+  // -- Canvas interface.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+
+private:
+  FrameProducer(int width, int height, int channel, void *memory,
+                size_t size);
+
+  const int width_, height_, channel_;
+  void *const memory_;
+  const size_t size_;
+  internal::SharedFrameHeader *const header_;
+  internal::SharedFrameChannel *const shared_channel_;
+  uint8_t *frame_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_FRAME_SERVER_H
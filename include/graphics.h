@@ -12,7 +12,10 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace rgb_matrix {
 struct Color {
@@ -32,15 +35,43 @@ public:
   Font();
   ~Font();
 
+  // Load font from file. This can be a *.bdf file or a binary font file
+  // created with WriteBinaryFont() (e.g. with utils/font-compiler); the
+  // format is detected automatically. Binary fonts are memory-mapped and
+  // used as-is, so they load in constant time regardless of size.
+  //
+  // Besides regular 1-bit fonts, grayscale (anti-aliased) BDF fonts with
+  // 2, 4 or 8 bits of coverage per pixel are supported; the bits per pixel
+  // are given as the last value of the SIZE line (see utils/ttf-rasterizer).
+  // If multiple fonts are loaded into the same Font, they need to have the
+  // same bits per pixel.
   bool LoadFont(const char *path);
   bool ReadFont(const char *font_file_as_string);
 
+  // Like LoadFont(), but for *.bdf files only the location of each glyph in
+  // the file is indexed; glyphs are decoded on first use and kept in a cache
+  // of at most "max_cached_glyphs" recently used glyphs. This keeps memory
+  // small for huge Unicode fonts of which only few characters are shown.
+  // Binary fonts are paged in on demand anyway, so for these this is the
+  // same as LoadFont().
+  // Replaces any previously loaded content.
+  bool LoadFontLazy(const char *path, int max_cached_glyphs = 256);
+
+  // Write the currently loaded font in the binary font format that can be
+  // loaded with LoadFont(). The file is in native byte-order.
+  // Returns 'false' on failure or if the font was loaded with LoadFontLazy().
+  bool WriteBinaryFont(const char *path) const;
+
   // Return height of font in pixels. Returns -1 if font has not been loaded.
   int height() const { return font_height_; }
 
   // Return baseline. Pixels from the topline to the baseline.
   int baseline() const { return base_line_; }
 
+  // Bits of coverage per pixel: 1 for regular fonts, 2, 4 or 8 for
+  // grayscale fonts.
+  int bits_per_pixel() const { return bits_per_pixel_; }
+
   // Return width of given character, or -1 if font is not loaded or character
   // does not exist.
   int CharacterWidth(uint32_t unicode_codepoint) const;
@@ -51,6 +82,10 @@ public:
   // The "y" position is the baseline of the font.
   // If we don't have it in the font, draws the replacement character "�" if
   // available.
+  // Partially covered pixels of grayscale fonts are blended between "color"
+  // and "background_color". Without background, they are blended towards
+  // black, as canvases can't be read back; this looks right on dark
+  // backgrounds, which is the common case on LED displays.
   // Returns how much we advance on the screen, which is the width of the
   // character or 0 if we didn't draw any character.
   int DrawGlyph(Canvas *c, int x, int y,
@@ -69,19 +104,63 @@ public:
   // The ownership of the returned pointer is passed to the caller.
   Font *CreateOutlineFont() const;
 
+  // Number identifying this font and its content, unique among all fonts
+  // of the process; it changes whenever a font is loaded into it. Used as
+  // cache key instead of the address, which a later font can reuse.
+  uint64_t generation() const { return generation_; }
+
 private:
   Font(const Font& x);  // No copy constructor. Use references or pointer instead.
 
   struct Glyph;
-  typedef std::map<uint32_t, Glyph*> CodepointGlyphMap;
+  struct ParseState;
+  struct LazyGlyphSource;
 
-  const Glyph *FindGlyph(uint32_t codepoint) const;
+  // Find glyph and its bitmap. For lazy fonts, the caller has to hold the
+  // lock while using the result.
+  const Glyph *FindGlyph(uint32_t codepoint, const uint8_t **bitmap) const;
+  int DrawGlyphBitmap(Canvas *c, int x, int y,
+                      const Color &color, const Color *background_color,
+                      const Glyph &glyph, const uint8_t *bitmap) const;
+  void DrawGrayscaleRows(Canvas *c, int x_pos, int y_pos,
+                         int x_min, int x_max, int y_min, int y_max,
+                         const Color &color, const Color *background_color,
+                         const Glyph &glyph, const uint8_t *bitmap) const;
+  static void OutlineGlyph(const Glyph &orig, const uint8_t *bitmap,
+                           int bits_per_pixel,
+                           Glyph *result, std::vector<uint8_t> *arena);
+  // Append the runs of the 1 bit per pixel "glyph", whose bitmap is at the
+  // end of "arena".
+  static void AppendRuns(Glyph *glyph, std::vector<uint8_t> *arena);
 
-  void parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row);
+  bool LoadBinaryFont(int fd);
+  void ReleaseMapping();    // Copy mapped data to own storage, unmap.
+  void DropLazySource();
+  void parseLine(const char* line, ParseState *state);
+  void FinishLoading();  // Sort parsed glyphs and build the lookup index.
+  void BuildIndex();
 
+  uint64_t generation_;
   int font_height_;
   int base_line_;
-  CodepointGlyphMap glyphs_;
+  int bits_per_pixel_;
+
+  // Glyphs in use, sorted by codepoint, and the bitmaps of all glyphs stored
+  // back-to-back as packed rows. These either point to the storage below or
+  // into a memory-mapped binary font file.
+  const Glyph *glyphs_;
+  size_t glyph_count_;
+  const uint8_t *bitmaps_;
+
+  std::vector<Glyph> glyph_storage_;
+  std::vector<uint8_t> bitmap_arena_;
+  void *mapped_file_;
+  size_t mapped_size_;
+  LazyGlyphSource *lazy_;   // Only set for fonts loaded with LoadFontLazy()
+
+  // Direct index into glyphs_ for the first 256 codepoints (ASCII/Latin-1);
+  // -1 if not present. Others are looked up with a binary search.
+  int32_t latin1_index_[256];
 };
 
 // -- Some utility functions.
@@ -125,6 +204,10 @@ int DrawText(Canvas *c, const Font &font, int x, int y,
 int DrawText(Canvas *c, const Font &font, int x, int y, const Color &color,
              const char *utf8_text);
 
+// Returns how many pixels DrawText() would advance for "utf8_text" with
+// "font" and "kerning_offset", without drawing anything.
+int TextWidth(const Font &font, const char *utf8_text, int kerning_offset = 0);
+
 // Draw text, a standard NUL terminated C-string encoded in UTF-8,
 // with given "font" at "x","y" with "color".
 // Draw text as above, but vertically (top down).
@@ -137,6 +220,123 @@ int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
                      const Color &color, const Color *background_color,
                      const char *utf8_text, int kerning_offset = 0);
 
+// -- Text layout.
+//
+// If the same text is drawn again and again (e.g. labels that are redrawn
+// every frame), laying it out once with a TextLayout and just drawing the
+// prepared result avoids re-doing the UTF-8 decoding, measuring and line
+// breaking each time.
+
+// Optional pair-kerning: extra spacing (typically negative) between two
+// specific characters, e.g. to tuck "o" under "T".
+class KerningTable {
+public:
+  KerningTable();
+
+  void Set(uint32_t left_codepoint, uint32_t right_codepoint, int adjust);
+  int Get(uint32_t left_codepoint, uint32_t right_codepoint) const;
+  bool empty() const { return pairs_.empty(); }
+
+  // Like Font::generation(): unique, and changes with each Set().
+  uint64_t generation() const { return generation_; }
+
+private:
+  std::map<uint64_t, int> pairs_;
+  uint64_t generation_;
+};
+
+struct TextLayoutOptions {
+  TextLayoutOptions();   // Creates a default option set.
+
+  enum Alignment { ALIGN_LEFT, ALIGN_CENTER, ALIGN_RIGHT };
+
+  int letter_spacing;    // Extra pixels between characters. Default 0.
+  int line_spacing;      // Extra pixels between lines. Default 0.
+
+  // If > 0, lines are broken at spaces to fit into this width; words that
+  // are wider are broken between characters. Lines are always broken at
+  // newline characters. Default 0.
+  int wrap_width;
+
+  // Horizontal alignment of each line within the width of the layout.
+  Alignment alignment;   // Default ALIGN_LEFT.
+
+  // If > 0, only this many lines are laid out; the rest is dropped.
+  int max_lines;
+
+  // Optional kerning table, can be NULL (default). Needs to stay alive while
+  // layouts are created with it.
+  const KerningTable *kerning;
+};
+
+// Text that has been laid out with a particular font and options: the
+// position of each glyph is computed once, so drawing only needs to blit.
+class TextLayout {
+public:
+  // Lay out the UTF-8 encoded "utf8_text" with "font". The font needs to
+  // outlive this layout.
+  TextLayout(const Font &font, const char *utf8_text,
+             const TextLayoutOptions &options = TextLayoutOptions());
+
+  // Width of the layout: the wrap width if set, otherwise the widest line.
+  int width() const { return width_; }
+
+  // Height of all lines including line spacing.
+  int height() const { return height_; }
+
+  int line_count() const { return line_count_; }
+
+  // Draw the text with the top-left corner of the layout at "x", "y".
+  // "background_color" can be NULL for transparency.
+  void Draw(Canvas *c, int x, int y, const Color &color,
+            const Color *background_color = NULL) const;
+
+private:
+  struct PlacedGlyph {
+    uint32_t codepoint;
+    int x;         // Relative to layout left.
+    int baseline;  // Relative to layout top.
+  };
+
+  const Font &font_;
+  std::vector<PlacedGlyph> glyphs_;
+  int width_;
+  int height_;
+  int line_count_;
+};
+
+// A cache of TextLayouts keyed by font, text and options, for applications
+// that draw the same strings many times. Keeps up to "max_entries" recently
+// used layouts. Fonts and kerning tables are identified by their
+// generation(), so layouts of deleted or reloaded fonts are never returned;
+// they just age out of the cache.
+class TextLayoutCache {
+public:
+  explicit TextLayoutCache(int max_entries = 64);
+  ~TextLayoutCache();
+
+  // Get the layout for the given text, creating it if needed. The returned
+  // layout is owned by the cache and valid until the next call to Get().
+  const TextLayout &Get(const Font &font, const char *utf8_text,
+                        const TextLayoutOptions &options = TextLayoutOptions());
+
+  void Clear();
+
+private:
+  struct Entry {
+    std::string key;
+    TextLayout *layout;
+  };
+  typedef std::list<Entry> EntryList;
+  typedef std::map<std::string, EntryList::iterator> LayoutMap;
+
+  TextLayoutCache(const TextLayoutCache &);  // No copy.
+
+  const size_t max_entries_;
+  EntryList entries_;   // Most recently used first.
+  LayoutMap layouts_;   // Index into entries_.
+};
+
 // Draw a circle centered at "x", "y", with a radius of "radius" and with "color"
 void DrawCircle(Canvas *c, int x, int y, int radius, const Color &color);
 
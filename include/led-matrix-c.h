@@ -38,6 +38,7 @@ extern "C" {
 struct RGBLedMatrix;
 struct LedCanvas;
 struct LedFont;
+struct LedFrameProducer;
 
 /**
  * Parameters to create a new matrix.
@@ -211,6 +212,19 @@ struct Color {
   uint8_t b;
 };
 
+/**
+ * Memory layouts of pixels for led_canvas_set_pixel_buffer(). The "A" or
+ * "X" byte of four-byte formats is ignored.
+ */
+enum LedPixelFormat {
+  LED_PIXEL_FORMAT_RGB = 0,    /* 3 bytes: red, green, blue */
+  LED_PIXEL_FORMAT_BGR = 1,    /* 3 bytes: blue, green, red */
+  LED_PIXEL_FORMAT_RGBA = 2,   /* 4 bytes: red, green, blue, alpha */
+  LED_PIXEL_FORMAT_BGRA = 3,   /* 4 bytes: blue, green, red, alpha */
+  LED_PIXEL_FORMAT_ARGB = 4,   /* 4 bytes: alpha, red, green, blue */
+  LED_PIXEL_FORMAT_ABGR = 5    /* 4 bytes: alpha, blue, green, red */
+};
+
 /**
  * Universal way to create and initialize a matrix.
  * The "options" struct (if not NULL) contains all default configuration values
@@ -327,6 +341,32 @@ void led_canvas_set_pixel(struct LedCanvas *canvas, int x, int y,
 void led_canvas_set_pixels(struct LedCanvas *canvas, int x, int y,
                            int width, int height, struct Color *colors);
 
+/**
+ * Copies an image of size (width, height) to the rectangle at (x, y), in
+ * one call without going through every pixel. Pixels are laid out as given
+ * by "format"; rows start "stride" bytes apart, 0 meaning right after each
+ * other. Parts outside the canvas are clipped, so (x, y) can be negative.
+ * Unknown formats are ignored.
+ */
+void led_canvas_set_pixel_buffer(struct LedCanvas *canvas, int x, int y,
+                                 int width, int height,
+                                 const uint8_t *pixels, int stride,
+                                 enum LedPixelFormat format);
+
+/**
+ * Copies everything from "src" to "dst"; both need to be created by the same
+ * matrix.
+ */
+void led_canvas_copy(struct LedCanvas *dst, const struct LedCanvas *src);
+
+/**
+ * Copies the rectangle at (x, y) with size (width, height) from "src" to the
+ * same place in "dst"; both need to be created by the same matrix. Much
+ * cheaper than setting the pixels again.
+ */
+void led_canvas_copy_region(struct LedCanvas *dst, const struct LedCanvas *src,
+                            int x, int y, int width, int height);
+
 /** Clear screen (black). */
 void led_canvas_clear(struct LedCanvas *canvas);
 
@@ -417,6 +457,32 @@ void draw_circle(struct LedCanvas *c, int x, int y, int radius,
 void draw_line(struct LedCanvas *c, int x0, int y0, int x1, int y1,
                uint8_t r, uint8_t g, uint8_t b);
 
+/*** Producer side of a frame server (see frame-server.h, utils/frame-server). ***/
+
+/**
+ * Connect to the shared memory "name" of a running frame server, claiming
+ * "channel", or the first free one if "channel" is -1. Returns NULL on
+ * failure.
+ */
+struct LedFrameProducer *frame_producer_connect(const char *name,
+                                               int channel);
+
+/** Disconnect and release the channel. */
+void frame_producer_delete(struct LedFrameProducer *producer);
+
+/** Return size of the frames. */
+void frame_producer_get_size(const struct LedFrameProducer *producer,
+                             int *width, int *height);
+
+/**
+ * The RGBA frame to draw into, (4 * width * height) bytes. Changes with
+ * every submit.
+ */
+uint8_t *frame_producer_frame(struct LedFrameProducer *producer);
+
+/** Show the frame. */
+void frame_producer_submit(struct LedFrameProducer *producer);
+
 #ifdef  __cplusplus
 }  // extern C
 #endif
@@ -201,8 +201,13 @@ public:
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixelBuffer(int x, int y, int width, int height,
+                              const uint8_t *pixels, int pixel_step,
+                              int stride, bool is_bgr);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SubFill(int x, int y, int width, int height,
+                       uint8_t red, uint8_t green, uint8_t blue);
 
   // -- Double- and Multibuffering.
 
@@ -220,6 +225,21 @@ public:
   // when the RGBMatrix is deleted).
   FrameCanvas *CreateFrameCanvas();
 
+  // Create a FrameCanvas that is "virtual_width" pixels wide, but of which
+  // only a window as wide as this RGBMatrix is shown, starting at the column
+  // set with FrameCanvas::SetScrollOffset() and wrapping around at the end.
+  //
+  // The offset is applied by the refresh loop while shifting out the pixels,
+  // so scrolling content on an active canvas only requires updating the
+  // offset and drawing newly exposed columns; no SwapOnVSync() needed.
+  //
+  // This needs the pixels to be laid out as plain panel rows, so it is not
+  // available with pixel mappers or multiplexing that re-arrange columns or
+  // rows. Returns NULL in that case, or if "virtual_width" is smaller than
+  // the width of this RGBMatrix.
+  // Ownership is with the RGBMatrix, like with CreateFrameCanvas().
+  FrameCanvas *CreateScrollingFrameCanvas(int virtual_width);
+
   // This method waits to the next VSync and swaps the active buffer with the
   // supplied buffer. The formerly active buffer is returned.
   //
@@ -238,6 +258,26 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // -- Event loop integration (e.g. epoll, Python asyncio). Instead of
+  // blocking, wait for a file descriptor (an eventfd) to become readable;
+  // read 8 bytes from it to reset it.
+
+  // Like SwapOnVSync(), but returns right away. Once "other" is shown,
+  // vsync_fd() becomes readable; only then the returned canvas, the one
+  // shown before, can be drawn into. Wait for that before scheduling the
+  // next swap.
+  FrameCanvas *ScheduleSwap(FrameCanvas *other,
+                            unsigned framerate_fraction = 1);
+
+  // Readable after a swap scheduled with ScheduleSwap() happened.
+  // -1 if there is no refresh thread.
+  int vsync_fd() const;
+
+  // Readable after the inputs requested with RequestInputs() changed; then
+  // AwaitInputChange(0) returns the new state. -1 if there is no refresh
+  // thread.
+  int input_fd() const;
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -375,8 +415,22 @@ public:
   bool Deserialize(const char *data, size_t len);
 
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
+  // Only copies between canvases of the same size.
   void CopyFrom(const FrameCanvas &other);
 
+  // Copy only the given area from another FrameCanvas of the same
+  // RGBMatrix. Much cheaper than setting the pixels again if only a part
+  // of a canvas needs to catch up with another one.
+  void CopyRegionFrom(const FrameCanvas &other,
+                      int x, int y, int width, int height);
+
+  // -- For canvases created with RGBMatrix::CreateScrollingFrameCanvas()
+
+  // Set the first column of this canvas shown at the left edge of the
+  // display; taken modulo width(). Takes effect with the next refresh.
+  void SetScrollOffset(int offset);
+  int scroll_offset() const;
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -384,12 +438,16 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void SetPixels(int x, int y, int width, int height,
                          Color *colors);
+  virtual void SetPixelBuffer(int x, int y, int width, int height,
+                              const uint8_t *pixels, int pixel_step,
+                              int stride, bool is_bgr);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
   virtual void SubFill(int x, int y, int width, int height, uint8_t red, uint8_t green, uint8_t blue);
   
 private:
   friend class RGBMatrix;
+  friend class ScrollStrip;
 
   FrameCanvas(internal::Framebuffer *frame) : frame_(frame){}
   virtual ~FrameCanvas();   // Any FrameCanvas is owned by RGBMatrix.
@@ -0,0 +1,69 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// An off-screen strip of content that is wider than the display, e.g. a
+// rendered line of text for a ticker. Content is drawn into it once with
+// the usual Canvas functions; each frame, a display-wide window of it is
+// then copied onto a FrameCanvas.
+//
+// Before copying, the strip is converted into the internal bitplane
+// representation of the FrameCanvas, so showing a frame is merely copying
+// rows of pre-encoded words, independent of how expensive it was to draw
+// the content in the first place.
+
+#ifndef RPI_SCROLL_STRIP_H
+#define RPI_SCROLL_STRIP_H
+
+#include "canvas.h"
+#include "graphics.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+class ScrollStrip : public Canvas {
+public:
+  // Create a strip with the given dimensions. Typically, the height is the
+  // height of the display, the width whatever the content needs.
+  ScrollStrip(int width, int height);
+  virtual ~ScrollStrip();
+
+  // Copy a window of the strip, starting at strip column "offset", to
+  // the full width of the FrameCanvas. The strip wraps around at its end,
+  // so any offset is valid, and scrolling is just a matter of changing the
+  // offset.
+  // Rows beyond the height of either the strip or the canvas are not
+  // touched.
+  //
+  // The strip is converted to the internal representation on first use
+  // and whenever the content or the relevant settings of the canvas
+  // (pwm bits, brightness, luminance correction, mapping) change.
+  void Blit(FrameCanvas *canvas, int offset);
+
+  // -- Canvas interface.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SubFill(int x, int y, int width, int height,
+                       uint8_t red, uint8_t green, uint8_t blue);
+
+private:
+  struct Encoding;
+
+  ScrollStrip(const ScrollStrip &);  // No copy.
+
+  void Encode(FrameCanvas *canvas);
+
+  const int width_;
+  const int height_;
+  std::vector<Color> pixels_;
+  Encoding *const encoding_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_SCROLL_STRIP_H
@@ -0,0 +1,75 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Down-scaling of planar YUV 4:2:0 images, the output of most video
+// decoders, directly onto a FrameCanvas.
+//
+// Each output pixel is the average of the source area it covers, which is
+// what we want when shrinking a video to the few pixels of a matrix. Only
+// one output row at a time is kept in RGB, so there is no full-size
+// intermediate image: reading the planes, averaging, color conversion and
+// writing the bitplanes of the canvas happen row by row while the data is
+// still in the cache.
+
+#ifndef RPI_YUV_SCALER_H
+#define RPI_YUV_SCALER_H
+
+#include "graphics.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+// A YUV 4:2:0 image with three planes. The chroma planes "u" and "v" have
+// half the width and height (rounded up) of the luma plane "y".
+struct YUV420Image {
+  int width, height;              // Of the luma plane.
+  const uint8_t *y, *u, *v;
+  int y_stride, u_stride, v_stride;   // Bytes between rows.
+};
+
+class YUV420Scaler {
+public:
+  enum ColorSpace {
+    BT601,     // Standard definition video; the default of most decoders.
+    BT709,     // HD video.
+  };
+
+  // Scaler from "src_width" x "src_height" images to "dst_width" x
+  // "dst_height" pixels. "full_range" is true if luma and chroma use the
+  // full range of 0..255 (JPEG, 'yuvj' formats), false for the usual
+  // video range of 16..235 (luma) and 16..240 (chroma).
+  YUV420Scaler(int src_width, int src_height, int dst_width, int dst_height,
+               ColorSpace color_space, bool full_range);
+
+  // Scale "image", which needs to have the size given in the constructor,
+  // and write it to "canvas" with the top left corner at "x","y".
+  void Scale(const YUV420Image &image, FrameCanvas *canvas, int x, int y);
+
+private:
+  // Range [start, end) of source pixels that make up one output pixel.
+  struct Span {
+    int start, end;
+  };
+
+  static void ComputeSpans(int src_size, int dst_size, std::vector<Span> *spans);
+  static void SumRows(const uint8_t *plane, int stride, int width,
+                      const Span &rows, uint32_t *sums);
+
+  const int src_width_, src_height_;
+  const int dst_width_, dst_height_;
+  const bool full_range_;
+  int red_v_, green_u_, green_v_, blue_u_;   // Conversion factors, 8.8 fixed.
+
+  std::vector<Span> columns_, rows_;                 // Luma.
+  std::vector<Span> chroma_columns_, chroma_rows_;   // Same areas in chroma.
+
+  // Scratch space: sums of the current rows for each source column.
+  std::vector<uint32_t> y_sums_, u_sums_, v_sums_;
+  std::vector<Color> output_row_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_YUV_SCALER_H
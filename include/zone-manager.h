@@ -0,0 +1,104 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Independent rectangular zones on one display, each updated at its own
+// pace, e.g. a video in one area, a clock updating once a second and a
+// ticker in another.
+//
+// Every zone is a Canvas with its own buffer that a producer, possibly in
+// its own thread, draws into and then commits. The ZoneManager only writes
+// the zones that were committed since the last frame into the outgoing
+// FrameCanvas; the other zones are brought up to date by copying their
+// already encoded pixels from the canvas currently shown. So the cost of a
+// frame depends on the area that changed, not on the size of the display.
+
+#ifndef RPI_ZONE_MANAGER_H
+#define RPI_ZONE_MANAGER_H
+
+#include "canvas.h"
+#include "graphics.h"
+#include "thread.h"
+
+#include <pthread.h>
+#include <vector>
+
+namespace rgb_matrix {
+class FrameCanvas;
+class RGBMatrix;
+class ZoneManager;
+
+class Zone : public Canvas {
+public:
+  int x() const { return x_; }
+  int y() const { return y_; }
+
+  // Publish what was drawn so far; it is shown with the next
+  // ZoneManager::Update(). The drawing buffer keeps its content, so it
+  // can be modified incrementally. Can be called from any thread.
+  void Commit();
+
+  // -- Canvas interface. Draws into the buffer of this zone, which only
+  // the producer of this zone must use.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SubFill(int x, int y, int width, int height,
+                       uint8_t red, uint8_t green, uint8_t blue);
+
+private:
+  friend class ZoneManager;
+
+  Zone(ZoneManager *manager, int x, int y, int width, int height);
+  Zone(const Zone &);  // No copy.
+
+  bool Overlaps(const Zone &other) const;
+
+  ZoneManager *const manager_;
+  const int x_, y_, width_, height_;
+  std::vector<Color> drawing_;     // The producer draws here.
+  std::vector<Color> committed_;   // Last Commit(). Guarded by the manager.
+  bool committed_new_;             // Guarded by the manager.
+  std::vector<Color> shown_;       // Used by the manager.
+};
+
+class ZoneManager {
+public:
+  // Manage zones on "matrix", which is then driven by this manager.
+  ZoneManager(RGBMatrix *matrix);
+  ~ZoneManager();
+
+  // Add a zone, initially black. The zone is owned by the manager. Zones
+  // should not overlap; where they do, the zone added later is on top.
+  Zone *AddZone(int x, int y, int width, int height);
+
+  // Wait until any zone is committed, or at most "timeout_ms". Returns
+  // true if there is something to update.
+  bool WaitForCommits(long timeout_ms);
+
+  // Write the zones committed since the last call into the next canvas
+  // and show it with the next vsync. Returns false without swapping if
+  // no zone changed. Call from one thread only.
+  bool Update(unsigned framerate_fraction = 1);
+
+private:
+  friend class Zone;
+  ZoneManager(const ZoneManager &);  // No copy.
+
+  RGBMatrix *const matrix_;
+  FrameCanvas *offscreen_;
+  FrameCanvas *onscreen_;     // NULL until the first Update().
+  std::vector<Zone*> zones_;
+
+  // Zones written into the canvas now shown, but not into offscreen_.
+  std::vector<bool> stale_;
+
+  Mutex mutex_;
+  pthread_cond_t committed_;
+  bool have_commits_;         // Guarded by "mutex_".
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_ZONE_MANAGER_H
@@ -21,32 +21,171 @@
 #include <inttypes.h>
 
 #include "graphics.h"
+#include "thread.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
-#include <bitset>
+#include <unordered_map>
 #include <vector>
 
 // The little question-mark box "�" for unknown code.
 static const uint32_t kUnicodeReplacementCodepoint = 0xFFFD;
 
 namespace rgb_matrix {
-// Bitmap for one row. This limits the number of available columns.
-// Make wider if running into trouble.
+// Maximum glyph width we keep. Pixels beyond that are dropped.
 static constexpr int kMaxFontWidth = 196;
-typedef std::bitset<kMaxFontWidth> rowbitmap_t;
 
+// Glyph metrics. The bitmap lives in the bitmaps_ of the font: "height"
+// rows of "stride" bytes each, bits_per_pixel() bits of coverage per pixel,
+// leftmost pixel in the most significant bits.
+// The x_offset of the bounding box is already applied, so column 0 is the
+// left edge of the advance box.
+// For 1 bit per pixel, the bitmap is followed by "runs_size" bytes of
+// pre-rasterized runs of set pixels within the advance box, so that drawing
+// emits whole spans instead of testing every bit: for each row a count byte
+// followed by that many (start, length) byte pairs, ordered left to right.
+//
+// This struct is also the on-disk glyph table of binary font files, so
+// changing it requires bumping the file version. It has no implicit
+// padding, and glyphs are zeroed before they are filled in, so that
+// the same font always results in the same file.
 struct Font::Glyph {
-  int device_width, device_height;
-  int width, height;
-  int x_offset, y_offset;
-  std::vector<rowbitmap_t> bitmap;  // contains 'height' elements.
+  uint32_t codepoint;
+  uint32_t bitmap_offset;
+  uint32_t runs_size;
+  int16_t device_width, device_height;
+  int16_t height, y_offset;
+  uint8_t stride;
+  uint8_t reserved[3];  // Always zero.
+
+  // Bytes of bitmap and runs.
+  size_t data_size() const { return (size_t)stride * height + runs_size; }
+
+  bool operator<(const Glyph &other) const {
+    return codepoint < other.codepoint;
+  }
 };
 
+// Parser state while reading a BDF file.
+struct Font::ParseState {
+  ParseState() : bits_per_pixel(1), codepoint(0), device_width(0),
+                 device_height(0), have_glyph(false), row(-1) {
+    memset(&glyph, 0, sizeof(glyph));
+  }
+  int bits_per_pixel;               // From the SIZE line.
+  uint32_t codepoint;
+  int device_width, device_height;  // Last DWIDTH seen.
+  int x_offset;                     // Of current glyph.
+  int bitmap_width;                 // Pixels stored per row.
+  Glyph glyph;                      // Glyph currently being read.
+  bool have_glyph;
+  int row;
+};
+
+// Glyph source for lazily loaded fonts: an index of where each glyph is
+// located in the BDF file, and a bounded cache of decoded glyphs.
+struct Font::LazyGlyphSource {
+  struct IndexEntry {
+    uint32_t codepoint;
+    uint32_t offset;   // File offset of the ENCODING line.
+    uint32_t length;   // Bytes up to the next glyph.
+    bool operator<(const IndexEntry &other) const {
+      return codepoint < other.codepoint;
+    }
+  };
+  // Cache entries are linked in order of use by their slot number.
+  static const size_t kNoSlot = (size_t)-1;
+  struct CacheEntry {
+    Glyph glyph;
+    std::vector<uint8_t> bitmap;
+    size_t newer, older;
+  };
+
+  LazyGlyphSource() : fd(-1), outline_levels(0), max_cached(0),
+                      newest(kNoSlot), oldest(kNoSlot) {}
+  ~LazyGlyphSource() { if (fd >= 0) close(fd); }
+
+  // Find glyph, decode it if not in the cache. Needs to be called with
+  // "mutex" held.
+  const Glyph *Lookup(uint32_t codepoint, const uint8_t **bitmap);
+
+  void Unlink(size_t slot);
+  void MakeNewest(size_t slot);   // Slot must not be linked.
+
+  int fd;
+  ParseState defaults;              // Parse state before the first glyph.
+  std::vector<IndexEntry> index;    // Sorted by codepoint.
+  int outline_levels;               // How often to apply OutlineGlyph()
+  size_t max_cached;
+
+  Mutex mutex;
+  std::vector<CacheEntry> cache;
+  std::unordered_map<uint32_t, size_t> cache_index;   // Codepoint -> slot.
+  size_t newest, oldest;
+};
+
+// Binary font file. The header is followed by the glyph table (glyph_count
+// Glyph structs, sorted by codepoint), followed by bitmap_size bytes of
+// bitmaps. All in native byte-order, so that the file can be memory-mapped
+// and used directly.
+// The last character of the magic is the file version.
+static const char kBinaryFontMagic[8] = { 'R','G','B','F','O','N','T','3' };
+static const uint32_t kByteOrderMark = 0x01020304;
+struct BinaryFontHeader {
+  char magic[8];
+  uint32_t byte_order;    // kByteOrderMark in the writer's byte-order.
+  uint32_t glyph_size;    // sizeof(Glyph), to detect layout changes.
+  int32_t font_height;
+  int32_t base_line;
+  uint32_t glyph_count;
+  uint32_t bitmap_size;
+  uint32_t bits_per_pixel;
+};
+
+// Check if the file starts with the magic of a binary font, of any version.
+static bool HasBinaryFontMagic(int fd) {
+  char magic[sizeof(kBinaryFontMagic)];
+  return (read(fd, magic, sizeof(magic)) == sizeof(magic)
+          && memcmp(magic, kBinaryFontMagic, sizeof(magic) - 1) == 0);
+}
+
+static bool IsValidBitsPerPixel(int bpp) {
+  return bpp == 1 || bpp == 2 || bpp == 4 || bpp == 8;
+}
+
+static inline bool IsPixelSet(const uint8_t *row, int x) {
+  return row[x >> 3] & (0x80 >> (x & 7));
+}
+
+static inline void SetPixelBit(uint8_t *row, int x) {
+  row[x >> 3] |= (0x80 >> (x & 7));
+}
+
+// Coverage of pixel "x" in a row with "bpp" bits per pixel.
+static inline int GetLevel(const uint8_t *row, int x, int bpp) {
+  const int bit = x * bpp;
+  return (row[bit >> 3] >> (8 - bpp - (bit & 7))) & ((1 << bpp) - 1);
+}
+
+static inline void SetLevel(uint8_t *row, int x, int bpp, int level) {
+  const int bit = x * bpp;
+  const int shift = 8 - bpp - (bit & 7);
+  const uint8_t mask = ((1 << bpp) - 1) << shift;
+  row[bit >> 3] = (row[bit >> 3] & ~mask) | (level << shift);
+}
+
+// Mix "from" and "to" by the coverage "level" out of "max_level".
+static inline uint8_t Blend(uint8_t from, uint8_t to, int level, int max_level) {
+  return from + (to - from) * level / max_level;
+}
+
 static bool readNibble(char c, uint8_t* val) {
   if (c >= '0' && c <= '9') { *val = c - '0'; return true; }
   if (c >= 'a' && c <= 'f') { *val = c - 'a' + 0xa; return true; }
@@ -54,191 +193,756 @@ static bool readNibble(char c, uint8_t* val) {
   return false;
 }
 
-static bool parseBitmap(const char *buffer, rowbitmap_t* result) {
-  // Read the bitmap left-aligned to our buffer.
-  for (int pos = result->size() - 1; *buffer && pos >= 3; buffer+=1) {
+// Parse a hex bitmap row into the packed "result" row, shifted by x_offset
+// and clipped to "width" pixels.
+static bool parseBitmap(const char *buffer, int bits_per_pixel,
+                        int x_offset, int width, uint8_t *result) {
+  if (bits_per_pixel == 1) {
+    for (int x = x_offset; *buffer && x < width; buffer+=1, x += 4) {
+      uint8_t val;
+      if (!readNibble(*buffer, &val))
+        break;
+      for (int b = 0; b < 4; ++b) {
+        if ((val & (0x8 >> b)) && x + b >= 0 && x + b < width)
+          SetPixelBit(result, x + b);
+      }
+    }
+    return true;
+  }
+
+  // Grayscale: pixels are consecutive groups of bits_per_pixel bits.
+  const int max_level = (1 << bits_per_pixel) - 1;
+  uint32_t bits = 0;
+  int available = 0;
+  for (int x = x_offset; *buffer && x < width; buffer+=1) {
     uint8_t val;
     if (!readNibble(*buffer, &val))
       break;
-    (*result)[pos--] = val & 0x8;
-    (*result)[pos--] = val & 0x4;
-    (*result)[pos--] = val & 0x2;
-    (*result)[pos--] = val & 0x1;
+    bits = (bits << 4) | val;
+    for (available += 4; available >= bits_per_pixel; ++x) {
+      available -= bits_per_pixel;
+      const int level = (bits >> available) & max_level;
+      if (level && x >= 0 && x < width)
+        SetLevel(result, x, bits_per_pixel, level);
+    }
   }
   return true;
 }
 
-Font::Font() : font_height_(-1), base_line_(0) {}
-Font::~Font() {
-  for (CodepointGlyphMap::iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    delete it->second;
+// If "line" starts with "keyword" as a whole word, return the position right
+// after it, otherwise NULL.
+static const char *MatchKeyword(const char *line, const char *keyword) {
+  while (*keyword) {
+    if (*line++ != *keyword++) return NULL;
   }
+  return (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n'
+          || *line == '\0') ? line : NULL;
+}
+
+// Parse "count" integers separated by blanks. Does not go beyond the
+// end of the line.
+static bool ParseInts(const char *s, int count, int *out) {
+  for (int i = 0; i < count; ++i) {
+    while (*s == ' ' || *s == '\t') ++s;
+    const bool negative = (*s == '-');
+    if (*s == '-' || *s == '+') ++s;
+    if (*s < '0' || *s > '9') return false;
+    long value = 0;
+    for (/**/; *s >= '0' && *s <= '9'; ++s) {
+      if (value < 100000000) value = value * 10 + (*s - '0');
+    }
+    out[i] = negative ? -value : value;
+  }
+  return true;
+}
+
+static uint64_t NextFontGeneration() {
+  static uint64_t generation = 0;
+  return __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+}
+
+Font::Font() : generation_(NextFontGeneration()),
+               font_height_(-1), base_line_(0), bits_per_pixel_(1),
+               glyphs_(NULL), glyph_count_(0), bitmaps_(NULL),
+               mapped_file_(NULL), mapped_size_(0), lazy_(NULL) {
+  std::fill(latin1_index_, latin1_index_ + 256, -1);
+}
+
+Font::~Font() {
+  if (mapped_file_) munmap(mapped_file_, mapped_size_);
+  delete lazy_;
 }
 
-// TODO: that might not be working for all input files yet.
 bool Font::LoadFont(const char *path) {
   if (!path || !*path) return false;
-  FILE *f = fopen(path, "r");
-  if (f == NULL)
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
     return false;
-  uint32_t codepoint;
-  char buffer[1024];
-  Glyph tmp;
-  Glyph *current_glyph = NULL;
-  int row = 0;
+  if (HasBinaryFontMagic(fd)) {
+    const bool success = LoadBinaryFont(fd);
+    close(fd);
+    return success;
+  }
 
+  // TODO: that might not be working for all input files yet.
+  lseek(fd, 0, SEEK_SET);
+  FILE *f = fdopen(fd, "r");
+  if (f == NULL) {
+    close(fd);
+    return false;
+  }
+  ReleaseMapping();
+  DropLazySource();
+  char buffer[1024];
+  ParseState state;
   while (fgets(buffer, sizeof(buffer), f)) {
-    parseLine(buffer, current_glyph, codepoint, tmp, row);
+    parseLine(buffer, &state);
   }
   fclose(f);
+  FinishLoading();
   return true;
 }
 
 bool Font::ReadFont(const char *font_file_as_string) {
   if (!font_file_as_string || !*font_file_as_string) return false;
-  uint32_t codepoint;
-  uint32_t BUFFER_SIZE = 1024;
-  char buffer[BUFFER_SIZE];
-  Glyph tmp;
-  Glyph *current_glyph = NULL;
-  int row = 0;
-
-  std::istringstream f(font_file_as_string);
-  std::string line;
-  while (std::getline(f, line)) {
-    if (line.length() < BUFFER_SIZE) {
-      strcpy(buffer, line.data());
-    }
-    else {
-      return false;
+  ReleaseMapping();
+  DropLazySource();
+  ParseState state;
+  // Lines are parsed in place; the parser never reads beyond a newline.
+  for (const char *line = font_file_as_string; *line; /**/) {
+    parseLine(line, &state);
+    const char *eol = strchr(line, '\n');
+    if (eol == NULL) break;
+    line = eol + 1;
+  }
+  FinishLoading();
+  return true;
+}
+
+bool Font::LoadBinaryFont(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BinaryFontHeader)
+      || (uint64_t)st.st_size > SIZE_MAX)
+    return false;
+  const size_t size = st.st_size;
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+    return false;
+
+  const BinaryFontHeader *header = (const BinaryFontHeader*) mapped;
+  const Glyph *glyphs = (const Glyph*) (header + 1);
+  // Sizes are compared by subtracting from the remaining space, which can't
+  // wrap around, unlike adding up sizes from the file in a 32-bit size_t.
+  const size_t glyph_space = size - sizeof(BinaryFontHeader);
+  bool valid = (memcmp(header->magic, kBinaryFontMagic,
+                       sizeof(kBinaryFontMagic)) == 0
+                && header->byte_order == kByteOrderMark
+                && header->glyph_size == sizeof(Glyph)
+                && IsValidBitsPerPixel(header->bits_per_pixel)
+                && header->glyph_count <= glyph_space / sizeof(Glyph)
+                && header->bitmap_size
+                   <= glyph_space - header->glyph_count * sizeof(Glyph));
+  // Make sure we never access anything outside the mapped file.
+  for (uint32_t i = 0; valid && i < header->glyph_count; ++i) {
+    const Glyph &g = glyphs[i];
+    valid = (g.height >= 0 && g.device_width >= 0
+             && g.device_width <= g.stride * 8 / (int)header->bits_per_pixel
+             && g.bitmap_offset <= header->bitmap_size
+             && (size_t)g.stride * g.height
+                <= header->bitmap_size - g.bitmap_offset
+             && g.runs_size <= header->bitmap_size - g.bitmap_offset
+                               - (size_t)g.stride * g.height
+             && (i == 0 || glyphs[i-1].codepoint < g.codepoint));
+  }
+  if (!valid) {
+    fprintf(stderr, "Invalid or incompatible binary font file; "
+            "re-create it with the font-compiler.\n");
+    munmap(mapped, size);
+    return false;
+  }
+
+  // Loading a binary font replaces any previous content.
+  DropLazySource();
+  if (mapped_file_) munmap(mapped_file_, mapped_size_);
+  glyph_storage_.clear();
+  bitmap_arena_.clear();
+  mapped_file_ = mapped;
+  mapped_size_ = size;
+  font_height_ = header->font_height;
+  base_line_ = header->base_line;
+  bits_per_pixel_ = header->bits_per_pixel;
+  glyphs_ = glyphs;
+  glyph_count_ = header->glyph_count;
+  bitmaps_ = (const uint8_t*) (glyphs + header->glyph_count);
+  BuildIndex();
+  return true;
+}
+
+bool Font::LoadFontLazy(const char *path, int max_cached_glyphs) {
+  if (!path || !*path || max_cached_glyphs < 1) return false;
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (HasBinaryFontMagic(fd)) {
+    const bool success = LoadBinaryFont(fd);
+    close(fd);
+    return success;
+  }
+  FILE *f = fdopen(dup(fd), "r");
+  if (f == NULL) {
+    close(fd);
+    return false;
+  }
+
+  // Replace all previous content.
+  ReleaseMapping();
+  DropLazySource();
+  glyph_storage_.clear();
+  bitmap_arena_.clear();
+  bits_per_pixel_ = 1;
+  FinishLoading();
+
+  LazyGlyphSource *lazy = new LazyGlyphSource();
+  lazy->fd = fd;
+  lazy->max_cached = max_cached_glyphs;
+  lazy->cache.reserve(max_cached_glyphs);
+
+  // Single scan through the file. Everything up to the first glyph is
+  // parsed normally (font bounding box, default DWIDTH); after that, we only
+  // remember where each ENCODING line starts.
+  char buffer[1024];
+  size_t offset = 0;
+  bool at_line_start = true;
+  bool in_header = true;
+  int codepoint;
+  while (fgets(buffer, sizeof(buffer), f)) {
+    const size_t len = strlen(buffer);
+    const char *args;
+    if (at_line_start && (args = MatchKeyword(buffer, "ENCODING")) != NULL
+        && ParseInts(args, 1, &codepoint)) {
+      in_header = false;
+      // Same conversion as ParseState::codepoint of non-lazy loading.
+      LazyGlyphSource::IndexEntry entry = { (uint32_t)codepoint,
+                                            (uint32_t)offset, 0 };
+      lazy->index.push_back(entry);
+    } else if (in_header) {
+      parseLine(buffer, &lazy->defaults);
     }
+    at_line_start = (len > 0 && buffer[len-1] == '\n');
+    offset += len;
+  }
+  fclose(f);
+  lazy->defaults.have_glyph = false;
+  for (size_t i = 0; i < lazy->index.size(); ++i) {
+    const uint32_t end = (i + 1 < lazy->index.size())
+      ? lazy->index[i+1].offset : offset;
+    lazy->index[i].length = end - lazy->index[i].offset;
+  }
 
-    parseLine(buffer, current_glyph, codepoint, tmp, row);
+  // Stable, so that of duplicate codepoints the last one in the file wins.
+  std::stable_sort(lazy->index.begin(), lazy->index.end());
+  size_t out = 0;
+  for (size_t i = 0; i < lazy->index.size(); ++i) {
+    if (i + 1 < lazy->index.size()
+        && lazy->index[i].codepoint == lazy->index[i+1].codepoint)
+      continue;
+    lazy->index[out++] = lazy->index[i];
   }
+  lazy->index.resize(out);
+  lazy->index.shrink_to_fit();
+  lazy_ = lazy;
   return true;
 }
 
- void Font::parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row) {
-  int dummy;
-
-  if (sscanf(buffer, "FONTBOUNDINGBOX %d %d %d %d",
-             &dummy, &font_height_, &dummy, &base_line_) == 4) {
-    base_line_ += font_height_;
-             }
-  else if (sscanf(buffer, "ENCODING %ud", &codepoint) == 1) {
-    // parsed.
-  }
-  else if (sscanf(buffer, "DWIDTH %d %d", &tmp.device_width, &tmp.device_height
-                  ) == 2) {
-    // Limit to width we can actually display, limited by rowbitmap_t
-    tmp.device_width = std::min(tmp.device_width, kMaxFontWidth);
-    // parsed.
-                  }
-  else if (sscanf(buffer, "BBX %d %d %d %d", &tmp.width, &tmp.height,
-                  &tmp.x_offset, &tmp.y_offset) == 4) {
-    current_glyph = new Glyph();
-    *current_glyph = tmp;
-    current_glyph->bitmap.resize(tmp.height);
-    row = -1;  // let's not start yet, wait for BITMAP
-                  }
-  else if (strncmp(buffer, "BITMAP", strlen("BITMAP")) == 0) {
-    row = 0;
-  }
-  else if (current_glyph && row >= 0 && row < current_glyph->height
-           && parseBitmap(buffer, &current_glyph->bitmap[row])) {
-    current_glyph->bitmap[row] >>= current_glyph->x_offset;
-    row++;
-           }
-  else if (strncmp(buffer, "ENDCHAR", strlen("ENDCHAR")) == 0) {
-    if (current_glyph && row == current_glyph->height) {
-      delete glyphs_[codepoint];  // just in case there was one.
-      glyphs_[codepoint] = current_glyph;
-      current_glyph = NULL;
+const Font::Glyph *Font::LazyGlyphSource::Lookup(uint32_t codepoint,
+                                                 const uint8_t **bitmap) {
+  std::unordered_map<uint32_t, size_t>::const_iterator cached
+    = cache_index.find(codepoint);
+  if (cached != cache_index.end()) {
+    CacheEntry &entry = cache[cached->second];
+    if (cached->second != newest) {
+      Unlink(cached->second);
+      MakeNewest(cached->second);
     }
+    *bitmap = entry.bitmap.data();
+    return &entry.glyph;
   }
 
+  IndexEntry key;
+  key.codepoint = codepoint;
+  std::vector<IndexEntry>::const_iterator found
+    = std::lower_bound(index.begin(), index.end(), key);
+  if (found == index.end() || found->codepoint != codepoint)
+    return NULL;
+
+  // Decode just this glyph from the file.
+  std::vector<char> text((size_t)found->length + 1);
+  const ssize_t r = pread(fd, text.data(), found->length, found->offset);
+  if (r < 0)
+    return NULL;
+  text[r] = '\0';
+  Font decoder;
+  ParseState state = defaults;
+  for (const char *line = text.data(); *line; /**/) {
+    decoder.parseLine(line, &state);
+    const char *eol = strchr(line, '\n');
+    if (eol == NULL) break;
+    line = eol + 1;
+  }
+  if (decoder.glyph_storage_.empty())
+    return NULL;
+  Glyph glyph = decoder.glyph_storage_.back();
+  std::vector<uint8_t> glyph_bitmap(
+    decoder.bitmap_arena_.begin() + glyph.bitmap_offset,
+    decoder.bitmap_arena_.begin() + glyph.bitmap_offset
+    + glyph.data_size());
+  glyph.bitmap_offset = 0;
+  for (int i = 0; i < outline_levels; ++i) {
+    Glyph outline;
+    std::vector<uint8_t> outline_bitmap;
+    OutlineGlyph(glyph, glyph_bitmap.data(), defaults.bits_per_pixel,
+                 &outline, &outline_bitmap);
+    glyph = outline;
+    glyph_bitmap.swap(outline_bitmap);
+  }
+
+  // Put into cache, evicting the least recently used entry if full.
+  size_t slot;
+  if (cache.size() < max_cached) {
+    slot = cache.size();
+    cache.push_back(CacheEntry());
+  } else {
+    slot = oldest;
+    Unlink(slot);
+    cache_index.erase(cache[slot].glyph.codepoint);
+  }
+  CacheEntry &entry = cache[slot];
+  entry.glyph = glyph;
+  entry.bitmap.swap(glyph_bitmap);
+  MakeNewest(slot);
+  cache_index[codepoint] = slot;
+  *bitmap = entry.bitmap.data();
+  return &entry.glyph;
 }
 
-Font *Font::CreateOutlineFont() const {
-  Font *r = new Font();
+void Font::LazyGlyphSource::Unlink(size_t slot) {
+  CacheEntry &entry = cache[slot];
+  if (entry.newer == kNoSlot) newest = entry.older;
+  else cache[entry.newer].older = entry.older;
+  if (entry.older == kNoSlot) oldest = entry.newer;
+  else cache[entry.older].newer = entry.newer;
+}
+
+void Font::LazyGlyphSource::MakeNewest(size_t slot) {
+  CacheEntry &entry = cache[slot];
+  entry.newer = kNoSlot;
+  entry.older = newest;
+  if (newest == kNoSlot) oldest = slot;
+  else cache[newest].newer = slot;
+  newest = slot;
+}
+
+void Font::DropLazySource() {
+  delete lazy_;
+  lazy_ = NULL;
+}
+
+bool Font::WriteBinaryFont(const char *path) const {
+  static_assert(sizeof(Glyph) == 24, "Glyph is written as-is, so it must "
+                "not have implicit padding.");
+  if (lazy_) return false;  // We don't have all glyphs in memory.
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+    return false;
+  BinaryFontHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kBinaryFontMagic, sizeof(header.magic));
+  header.byte_order = kByteOrderMark;
+  header.glyph_size = sizeof(Glyph);
+  header.font_height = font_height_;
+  header.base_line = base_line_;
+  header.glyph_count = glyph_count_;
+  header.bitmap_size = 0;
+  header.bits_per_pixel = bits_per_pixel_;
+  for (size_t i = 0; i < glyph_count_; ++i) {
+    const Glyph &g = glyphs_[i];
+    header.bitmap_size = std::max(header.bitmap_size,
+                                  (uint32_t)(g.bitmap_offset
+                                             + g.data_size()));
+  }
+  bool success = (fwrite(&header, sizeof(header), 1, out) == 1);
+  if (glyph_count_ > 0) {
+    success &= (fwrite(glyphs_, sizeof(Glyph), glyph_count_, out)
+                == glyph_count_);
+  }
+  if (header.bitmap_size > 0) {
+    success &= (fwrite(bitmaps_, header.bitmap_size, 1, out) == 1);
+  }
+  success &= (fclose(out) == 0);
+  return success;
+}
+
+void Font::ReleaseMapping() {
+  if (!mapped_file_) return;
+  glyph_storage_.assign(glyphs_, glyphs_ + glyph_count_);
+  size_t bitmap_size = 0;
+  for (size_t i = 0; i < glyph_count_; ++i) {
+    bitmap_size = std::max(bitmap_size, (size_t)glyphs_[i].bitmap_offset
+                           + glyphs_[i].data_size());
+  }
+  bitmap_arena_.assign(bitmaps_, bitmaps_ + bitmap_size);
+  munmap(mapped_file_, mapped_size_);
+  mapped_file_ = NULL;
+  mapped_size_ = 0;
+  glyphs_ = glyph_storage_.data();
+  bitmaps_ = bitmap_arena_.data();
+}
+
+void Font::parseLine(const char* line, ParseState *state) {
+  int v[4];
+  const char *args;
+
+  // By far most lines are bitmap rows, so check for these first.
+  if (state->have_glyph && state->row >= 0
+      && state->row < state->glyph.height) {
+    const Glyph &g = state->glyph;
+    parseBitmap(line, state->bits_per_pixel,
+                state->x_offset, state->bitmap_width,
+                &bitmap_arena_[g.bitmap_offset + state->row * g.stride]);
+    state->row++;
+  }
+  else if ((args = MatchKeyword(line, "FONTBOUNDINGBOX"))
+           && ParseInts(args, 4, v)) {
+    font_height_ = v[1];
+    base_line_ = v[3] + font_height_;
+  }
+  else if ((args = MatchKeyword(line, "SIZE"))) {
+    // SIZE <point-size> <x-res> <y-res> [<bits-per-pixel>]
+    if (ParseInts(args, 4, v)) {
+      if (IsValidBitsPerPixel(v[3])) {
+        state->bits_per_pixel = bits_per_pixel_ = v[3];
+      } else {
+        fprintf(stderr, "Unsupported %d bits per pixel in font.\n", v[3]);
+      }
+    }
+  }
+  else if ((args = MatchKeyword(line, "ENCODING")) && ParseInts(args, 1, v)) {
+    state->codepoint = v[0];
+  }
+  else if ((args = MatchKeyword(line, "DWIDTH")) && ParseInts(args, 2, v)) {
+    // Limit to width we can actually display.
+    state->device_width = std::max(0, std::min(v[0], kMaxFontWidth));
+    state->device_height = v[1];
+  }
+  else if ((args = MatchKeyword(line, "BBX")) && ParseInts(args, 4, v)) {
+    const int width = v[0];
+    const int height = std::max(0, v[1]);
+    if (state->have_glyph) {
+      // Previous glyph never finished; discard its bitmap.
+      bitmap_arena_.resize(state->glyph.bitmap_offset);
+    }
+    // Keep pixels that extend beyond the advance width, as they
+    // contribute to outlines.
+    state->bitmap_width = std::min(kMaxFontWidth,
+                                   std::max(state->device_width,
+                                            v[2] + width));
+    state->x_offset = v[2];
+    Glyph &g = state->glyph;
+    g.codepoint = state->codepoint;
+    g.bitmap_offset = bitmap_arena_.size();
+    g.device_width = state->device_width;
+    g.device_height = state->device_height;
+    g.height = height;
+    g.y_offset = v[3];
+    g.stride = (state->bitmap_width * state->bits_per_pixel + 7) / 8;
+    g.runs_size = 0;
+    bitmap_arena_.resize(bitmap_arena_.size() + g.stride * height);
+    state->have_glyph = true;
+    state->row = -1;  // let's not start yet, wait for BITMAP
+  }
+  else if (MatchKeyword(line, "BITMAP")) {
+    state->row = 0;
+  }
+  else if (MatchKeyword(line, "ENDCHAR")) {
+    if (state->have_glyph && state->row == state->glyph.height) {
+      state->glyph.codepoint = state->codepoint;
+      if (state->bits_per_pixel == 1)
+        AppendRuns(&state->glyph, &bitmap_arena_);
+      glyph_storage_.push_back(state->glyph);
+    } else if (state->have_glyph) {
+      bitmap_arena_.resize(state->glyph.bitmap_offset);
+    }
+    state->have_glyph = false;
+  }
+}
+
+void Font::FinishLoading() {
+  // Stable, so that of duplicate codepoints the last one loaded wins.
+  std::stable_sort(glyph_storage_.begin(), glyph_storage_.end());
+  size_t out = 0;
+  for (size_t i = 0; i < glyph_storage_.size(); ++i) {
+    if (i + 1 < glyph_storage_.size()
+        && glyph_storage_[i].codepoint == glyph_storage_[i+1].codepoint)
+      continue;
+    glyph_storage_[out++] = glyph_storage_[i];
+  }
+  glyph_storage_.resize(out);
+  glyph_storage_.shrink_to_fit();
+  bitmap_arena_.shrink_to_fit();
+
+  glyphs_ = glyph_storage_.data();
+  glyph_count_ = glyph_storage_.size();
+  bitmaps_ = bitmap_arena_.data();
+  BuildIndex();
+}
+
+void Font::BuildIndex() {
+  generation_ = NextFontGeneration();  // Called whenever new glyphs arrive.
+  std::fill(latin1_index_, latin1_index_ + 256, -1);
+  for (size_t i = 0; i < glyph_count_ && glyphs_[i].codepoint < 256; ++i) {
+    latin1_index_[glyphs_[i].codepoint] = i;
+  }
+}
+
+void Font::OutlineGlyph(const Glyph &orig, const uint8_t *in,
+                        int bpp, Glyph *result, std::vector<uint8_t> *arena) {
   const int kBorder = 1;
-  r->font_height_ = font_height_ + 2*kBorder;
-  r->base_line_ = base_line_ + kBorder;
-  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    const Glyph *orig = it->second;
-    const int height = orig->height + 2 * kBorder;
-    Glyph *const tmp_glyph = new Glyph();
-    tmp_glyph->bitmap.resize(height);
-    tmp_glyph->width  = orig->width  + 2*kBorder;
-    tmp_glyph->height = height;
-    tmp_glyph->device_width  = orig->device_width + 2*kBorder;
-    tmp_glyph->device_height = height;
-    tmp_glyph->y_offset = orig->y_offset - kBorder;
-    // TODO: we don't really need bounding box, right ?
-    const rowbitmap_t fill_pattern = 0b111;
-    const rowbitmap_t start_mask   = 0b010;
-    // Fill the border
-    for (int h = 0; h < orig->height; ++h) {
-      rowbitmap_t fill = fill_pattern;
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
-      for (rowbitmap_t m = start_mask; m.any(); m <<= 1, fill <<= 1) {
-        if ((orig_bitmap & m).any()) {
-          tmp_glyph->bitmap[h+kBorder-1] |= fill;
-          tmp_glyph->bitmap[h+kBorder+0] |= fill;
-          tmp_glyph->bitmap[h+kBorder+1] |= fill;
+  const int orig_width = orig.stride * 8 / bpp;
+  const int width = orig_width + 2*kBorder;
+  Glyph &g = *result;
+  memset(&g, 0, sizeof(g));
+  g.codepoint = orig.codepoint;
+  g.bitmap_offset = arena->size();
+  g.device_width  = orig.device_width + 2*kBorder;
+  g.height = orig.height + 2*kBorder;
+  g.device_height = g.height;
+  g.y_offset = orig.y_offset - kBorder;
+  g.stride = (width * bpp + 7) / 8;
+  g.runs_size = 0;
+  arena->resize(arena->size() + g.stride * g.height);
+  uint8_t *const out = arena->data() + g.bitmap_offset;
+
+  // Fill the border: every pixel of the original sets its 3x3
+  // neighborhood (the original is shifted by kBorder in both directions).
+  // For grayscale fonts, this is the maximum coverage in the neighborhood.
+  for (int h = 0; h < orig.height; ++h) {
+    const uint8_t *row = in + h * orig.stride;
+    for (int x = 0; x < orig_width; ++x) {
+      const int level = GetLevel(row, x, bpp);
+      if (!level) continue;
+      for (int dy = 0; dy <= 2*kBorder; ++dy) {
+        uint8_t *out_row = out + (h + dy) * g.stride;
+        for (int dx = 0; dx <= 2*kBorder; ++dx) {
+          if (GetLevel(out_row, x + dx, bpp) < level)
+            SetLevel(out_row, x + dx, bpp, level);
         }
       }
     }
-    // Remove original font again.
-    for (int h = 0; h < orig->height; ++h) {
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
-      tmp_glyph->bitmap[h+kBorder] &= ~orig_bitmap;
+  }
+  // Remove original font again.
+  for (int h = 0; h < orig.height; ++h) {
+    const uint8_t *row = in + h * orig.stride;
+    uint8_t *out_row = out + (h + kBorder) * g.stride;
+    for (int x = 0; x < orig_width; ++x) {
+      const int level = GetLevel(row, x, bpp);
+      if (!level) continue;
+      const int border = GetLevel(out_row, x + kBorder, bpp);
+      SetLevel(out_row, x + kBorder, bpp, std::max(0, border - level));
+    }
+  }
+  if (bpp == 1) AppendRuns(&g, arena);
+}
+
+void Font::AppendRuns(Glyph *glyph, std::vector<uint8_t> *arena) {
+  // The bitmap is at the end of the arena, which might be reallocated
+  // while appending, so it is addressed by offset.
+  const size_t runs_offset = arena->size();
+  const int width = std::min((int)glyph->device_width, 255);
+  for (int y = 0; y < glyph->height; ++y) {
+    const size_t row = glyph->bitmap_offset + y * glyph->stride;
+    const size_t count_pos = arena->size();
+    arena->push_back(0);
+    for (int x = 0; x < width; /**/) {
+      if (!IsPixelSet(arena->data() + row, x)) { ++x; continue; }
+      const int start = x;
+      while (x < width && IsPixelSet(arena->data() + row, x)) ++x;
+      arena->push_back(start);
+      arena->push_back(x - start);
+      (*arena)[count_pos]++;
     }
-    r->glyphs_[it->first] = tmp_glyph;
   }
+  glyph->runs_size = arena->size() - runs_offset;
+}
+
+Font *Font::CreateOutlineFont() const {
+  Font *r = new Font();
+  const int kBorder = 1;
+  r->font_height_ = font_height_ + 2*kBorder;
+  r->base_line_ = base_line_ + kBorder;
+  r->bits_per_pixel_ = bits_per_pixel_;
+  if (lazy_) {
+    // Outline glyphs are created on demand as well.
+    LazyGlyphSource *lazy = new LazyGlyphSource();
+    lazy->fd = dup(lazy_->fd);
+    lazy->defaults = lazy_->defaults;
+    lazy->index = lazy_->index;
+    lazy->outline_levels = lazy_->outline_levels + 1;
+    lazy->max_cached = lazy_->max_cached;
+    lazy->cache.reserve(lazy->max_cached);
+    r->lazy_ = lazy;
+    return r;
+  }
+  r->glyph_storage_.reserve(glyph_count_);
+  for (size_t i = 0; i < glyph_count_; ++i) {
+    Glyph g;
+    OutlineGlyph(glyphs_[i], bitmaps_ + glyphs_[i].bitmap_offset,
+                 bits_per_pixel_, &g, &r->bitmap_arena_);
+    r->glyph_storage_.push_back(g);
+  }
+  r->FinishLoading();
   return r;
 }
 
-const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint) const {
-  CodepointGlyphMap::const_iterator found = glyphs_.find(unicode_codepoint);
-  if (found == glyphs_.end())
-    return NULL;
-  return found->second;
+const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint,
+                                   const uint8_t **bitmap) const {
+  if (lazy_) return lazy_->Lookup(unicode_codepoint, bitmap);
+  const Glyph *found = NULL;
+  if (unicode_codepoint < 256) {
+    const int32_t index = latin1_index_[unicode_codepoint];
+    found = (index < 0) ? NULL : &glyphs_[index];
+  } else {
+    Glyph key;
+    key.codepoint = unicode_codepoint;
+    const Glyph *const end = glyphs_ + glyph_count_;
+    found = std::lower_bound(glyphs_, end, key);
+    if (found == end || found->codepoint != unicode_codepoint)
+      found = NULL;
+  }
+  if (found) *bitmap = bitmaps_ + found->bitmap_offset;
+  return found;
 }
 
 int Font::CharacterWidth(uint32_t unicode_codepoint) const {
-  const Glyph *g = FindGlyph(unicode_codepoint);
-  return g ? g->device_width : -1;
+  if (lazy_) lazy_->mutex.Lock();
+  const uint8_t *bitmap;
+  const Glyph *g = FindGlyph(unicode_codepoint, &bitmap);
+  const int width = g ? g->device_width : -1;
+  if (lazy_) lazy_->mutex.Unlock();
+  return width;
 }
 
 int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
                     const Color &color, const Color *bgcolor,
                     uint32_t unicode_codepoint) const {
-  const Glyph *g = FindGlyph(unicode_codepoint);
-  if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
-  if (g == NULL) return 0;
+  if (lazy_) lazy_->mutex.Lock();
+  const uint8_t *bitmap;
+  const Glyph *g = FindGlyph(unicode_codepoint, &bitmap);
+  if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint, &bitmap);
+  const int advance = g
+    ? DrawGlyphBitmap(c, x_pos, y_pos, color, bgcolor, *g, bitmap)
+    : 0;
+  if (lazy_) lazy_->mutex.Unlock();
+  return advance;
+}
+
+int Font::DrawGlyphBitmap(Canvas *c, int x_pos, int y_pos,
+                          const Color &color, const Color *bgcolor,
+                          const Glyph &glyph, const uint8_t *bitmap) const {
+  const Glyph *const g = &glyph;
   y_pos = y_pos - g->height - g->y_offset;
 
-  if (x_pos + g->device_width < 0 || x_pos > c->width() ||
-      y_pos + g->height < 0 || y_pos > c->height()) {
+  const int canvas_width = c->width();
+  const int canvas_height = c->height();
+  if (x_pos + g->device_width < 0 || x_pos > canvas_width ||
+      y_pos + g->height < 0 || y_pos > canvas_height) {
     return g->device_width;  // Outside canvas border. Bail out early.
   }
 
-  for (int y = 0; y < g->height; ++y) {
-    const rowbitmap_t& row = g->bitmap[y];
-    for (int x = 0; x < g->device_width; ++x) {
-      if (row.test(kMaxFontWidth - 1 - x)) {
-        c->SetPixel(x_pos + x, y_pos + y, color.r, color.g, color.b);
-      } else if (bgcolor) {
-        c->SetPixel(x_pos + x, y_pos + y, bgcolor->r, bgcolor->g, bgcolor->b);
+  // Clip once to the visible part of the glyph, so that the spans we emit
+  // don't need to be bounds-checked pixel by pixel.
+  const int x_min = std::max(0, -x_pos);
+  const int x_max = std::min((int)g->device_width, canvas_width - x_pos);
+  const int y_min = std::max(0, -y_pos);
+  const int y_max = std::min((int)g->height, canvas_height - y_pos);
+
+  if (bits_per_pixel_ > 1) {
+    DrawGrayscaleRows(c, x_pos, y_pos, x_min, x_max, y_min, y_max,
+                      color, bgcolor, *g, bitmap);
+    return g->device_width;
+  }
+
+  // Walk the runs of all rows up to the visible ones. Each run is clipped
+  // on its own; a truncated run table just ends the glyph.
+  const uint8_t *runs = bitmap + g->stride * g->height;
+  const uint8_t *const runs_end = runs + g->runs_size;
+  for (int y = 0; y < y_max && runs < runs_end; ++y) {
+    const int count = *runs++;
+    const uint8_t *const row_runs = runs;
+    if (runs_end - runs < 2 * count) break;
+    runs += 2 * count;
+    if (y < y_min) continue;
+    int background_start = x_min;
+    for (int r = 0; r < count; ++r) {
+      const int start = std::max((int)row_runs[2*r], x_min);
+      const int end = std::min(row_runs[2*r] + row_runs[2*r + 1], x_max);
+      if (start >= end) continue;
+      if (bgcolor && start > background_start) {
+        c->SubFill(x_pos + background_start, y_pos + y,
+                   start - background_start, 1,
+                   bgcolor->r, bgcolor->g, bgcolor->b);
       }
+      c->SubFill(x_pos + start, y_pos + y, end - start, 1,
+                 color.r, color.g, color.b);
+      background_start = end;
+    }
+    if (bgcolor && background_start < x_max) {
+      c->SubFill(x_pos + background_start, y_pos + y,
+                 x_max - background_start, 1,
+                 bgcolor->r, bgcolor->g, bgcolor->b);
     }
   }
   return g->device_width;
 }
 
+void Font::DrawGrayscaleRows(Canvas *c, int x_pos, int y_pos,
+                             int x_min, int x_max, int y_min, int y_max,
+                             const Color &color, const Color *bgcolor,
+                             const Glyph &g, const uint8_t *bitmap) const {
+  const int bpp = bits_per_pixel_;
+  const int max_level = (1 << bpp) - 1;
+
+  // Blend the color for each coverage level once, so that the rows are
+  // just runs of equal coverage filled with a table lookup.
+  const Color background = bgcolor ? *bgcolor : Color(0, 0, 0);
+  Color shade[256];
+  for (int level = 0; level <= max_level; ++level) {
+    shade[level].r = Blend(background.r, color.r, level, max_level);
+    shade[level].g = Blend(background.g, color.g, level, max_level);
+    shade[level].b = Blend(background.b, color.b, level, max_level);
+  }
+
+  const int pixels_per_byte = 8 / bpp;
+  for (int y = y_min; y < y_max; ++y) {
+    const uint8_t *row = bitmap + y * g.stride;
+    int x = x_min;
+    while (x < x_max) {
+      // Transparent background: skip over whole empty bytes at once.
+      if (!bgcolor && (x % pixels_per_byte) == 0
+          && row[x / pixels_per_byte] == 0) {
+        x += pixels_per_byte;
+        continue;
+      }
+      const int level = GetLevel(row, x, bpp);
+      const int start = x;
+      while (++x < x_max && GetLevel(row, x, bpp) == level) {}
+      if (level == 0 && !bgcolor)
+        continue;
+      const Color &s = shade[level];
+      c->SubFill(x_pos + start, y_pos + y, x - start, 1, s.r, s.g, s.b);
+    }
+  }
+}
+
 int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos, const Color &color,
                     uint32_t unicode_codepoint) const {
   return DrawGlyph(c, x_pos, y_pos, color, NULL, unicode_codepoint);
@@ -0,0 +1,273 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "compositor.h"
+#include "led-matrix.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace rgb_matrix {
+
+// x / 255, rounded, for x in 0..255*255. In 16 bits, which is all that is
+// needed, so that the compiler can use narrow vector lanes.
+static inline uint16_t DivBy255(uint16_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+// Blend one pixel with the given "alpha" over "dst". Without special cases
+// for transparent or opaque pixels: DivBy255() is exact for multiples of
+// 255, so alpha 0 keeps "dst" and alpha 255 yields "src" unchanged.
+static inline void BlendPixel(Color *dst, const uint8_t *src,
+                              uint16_t alpha) {
+  const uint16_t inverse = 255 - alpha;
+  dst->r = DivBy255(src[0] * alpha + dst->r * inverse);
+  dst->g = DivBy255(src[1] * alpha + dst->g * inverse);
+  dst->b = DivBy255(src[2] * alpha + dst->b * inverse);
+}
+
+// Blend "count" pixels of "src" with the given layer "opacity" over "dst".
+// The loops have no branches and no dependencies between pixels, so that
+// the compiler can vectorize them where the target supports it; the
+// opacity is only applied for layers that are not fully opaque.
+static void BlendRow(Color *dst, const uint8_t *src, int count,
+                     uint16_t opacity) {
+  if (opacity == 255) {
+    for (int i = 0; i < count; ++i) {
+      BlendPixel(&dst[i], src + 4*i, src[4*i + 3]);
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      BlendPixel(&dst[i], src + 4*i, DivBy255(src[4*i + 3] * opacity));
+    }
+  }
+}
+
+void Layer::Rect::Add(const Rect &other) {
+  if (other.empty()) return;
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  x0 = std::min(x0, other.x0);
+  y0 = std::min(y0, other.y0);
+  x1 = std::max(x1, other.x1);
+  y1 = std::max(y1, other.y1);
+}
+
+Layer::Rect Layer::Rect::Intersect(const Rect &other) const {
+  return Rect(std::max(x0, other.x0), std::max(y0, other.y0),
+              std::min(x1, other.x1), std::min(y1, other.y1));
+}
+
+Layer::Layer(int width, int height)
+  : width_(std::max(width, 0)), height_(std::max(height, 0)),
+    pixels_(width_ * height_), x_(0), y_(0), opacity_(255), visible_(true),
+    placement_changed_(true) {
+  Clear();
+}
+
+void Layer::SetPosition(int x, int y) {
+  if (x == x_ && y == y_) return;
+  x_ = x;
+  y_ = y;
+  placement_changed_ = true;
+}
+
+void Layer::SetOpacity(uint8_t opacity) {
+  if (opacity == opacity_) return;
+  opacity_ = opacity;
+  placement_changed_ = true;
+}
+
+void Layer::SetVisible(bool visible) {
+  if (visible == visible_) return;
+  visible_ = visible;
+  placement_changed_ = true;
+}
+
+void Layer::SetPixelRGBA(int x, int y,
+                         uint8_t red, uint8_t green, uint8_t blue,
+                         uint8_t alpha) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  Pixel &p = pixels_[y * width_ + x];
+  p.r = red;
+  p.g = green;
+  p.b = blue;
+  p.a = alpha;
+  dirty_.Add(Rect(x, y, x + 1, y + 1));
+}
+
+void Layer::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+  SetPixelRGBA(x, y, red, green, blue, 255);
+}
+
+void Layer::SetImage(int x, int y, const uint8_t *rgba,
+                     int width, int height, int stride) {
+  const Rect r = Rect(x, y, x + width, y + height)
+    .Intersect(Rect(0, 0, width_, height_));
+  if (r.empty()) return;
+  for (int row = r.y0; row < r.y1; ++row) {
+    memcpy(&pixels_[row * width_ + r.x0],
+           rgba + (row - y) * stride + (r.x0 - x) * 4,
+           (r.x1 - r.x0) * sizeof(Pixel));
+  }
+  dirty_.Add(r);
+}
+
+void Layer::FillRGBA(int x, int y, int width, int height, const Pixel &p) {
+  const Rect r = Rect(x, y, x + width, y + height)
+    .Intersect(Rect(0, 0, width_, height_));
+  if (r.empty()) return;
+  for (int row = r.y0; row < r.y1; ++row) {
+    std::fill(pixels_.begin() + row * width_ + r.x0,
+              pixels_.begin() + row * width_ + r.x1, p);
+  }
+  dirty_.Add(r);
+}
+
+void Layer::Clear() {
+  const Pixel transparent = { 0, 0, 0, 0 };
+  FillRGBA(0, 0, width_, height_, transparent);
+}
+
+void Layer::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  SubFill(0, 0, width_, height_, red, green, blue);
+}
+
+void Layer::SubFill(int x, int y, int width, int height,
+                    uint8_t red, uint8_t green, uint8_t blue) {
+  const Pixel p = { red, green, blue, 255 };
+  FillRGBA(x, y, width, height, p);
+}
+
+Compositor::Compositor(int width, int height)
+  : width_(std::max(width, 0)), height_(std::max(height, 0)),
+    composed_(width_ * height_) {
+  Invalidate();
+}
+
+Compositor::~Compositor() {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    delete layers_[i];
+  }
+}
+
+Layer *Compositor::AddLayer(int width, int height) {
+  Layer *layer = new Layer(width, height);
+  layers_.push_back(layer);
+  return layer;
+}
+
+void Compositor::RemoveLayer(Layer *layer) {
+  std::vector<Layer*>::iterator found
+    = std::find(layers_.begin(), layers_.end(), layer);
+  if (found == layers_.end()) return;
+  changed_.Add(layer->composed_rect_);
+  layers_.erase(found);
+  delete layer;
+}
+
+void Compositor::SetBackground(const Color &color) {
+  background_ = color;
+  Invalidate();
+}
+
+void Compositor::Invalidate() {
+  changed_ = Layer::Rect(0, 0, width_, height_);
+}
+
+void Compositor::Update() {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    Layer *layer = layers_[i];
+    const bool shown = layer->visible_ && layer->opacity_ > 0;
+    if (layer->placement_changed_) {
+      changed_.Add(layer->composed_rect_);
+      if (shown) changed_.Add(layer->ScreenRect());
+    } else if (shown && !layer->dirty_.empty()) {
+      const Layer::Rect &d = layer->dirty_;
+      changed_.Add(Layer::Rect(d.x0 + layer->x_, d.y0 + layer->y_,
+                               d.x1 + layer->x_, d.y1 + layer->y_));
+    }
+    layer->composed_rect_ = shown ? layer->ScreenRect() : Layer::Rect();
+    layer->dirty_ = Layer::Rect();
+    layer->placement_changed_ = false;
+  }
+
+  const Layer::Rect region = changed_.Intersect(Layer::Rect(0, 0,
+                                                            width_, height_));
+  changed_ = Layer::Rect();
+  if (region.empty()) return;
+  BlendRegion(region);
+  for (std::map<const Canvas*, Layer::Rect>::iterator it
+         = target_dirty_.begin(); it != target_dirty_.end(); ++it) {
+    it->second.Add(region);
+  }
+}
+
+void Compositor::BlendRegion(const Layer::Rect &region) {
+  for (int y = region.y0; y < region.y1; ++y) {
+    Color *const row = &composed_[y * width_];
+    std::fill(row + region.x0, row + region.x1, background_);
+    for (size_t i = 0; i < layers_.size(); ++i) {
+      const Layer *layer = layers_[i];
+      if (!layer->visible_ || layer->opacity_ == 0
+          || y < layer->y_ || y >= layer->y_ + layer->height_)
+        continue;
+      const int x0 = std::max(region.x0, layer->x_);
+      const int x1 = std::min(region.x1, layer->x_ + layer->width_);
+      if (x0 >= x1) continue;
+      const Layer::Pixel *src
+        = &layer->pixels_[(y - layer->y_) * layer->width_ + x0 - layer->x_];
+      BlendRow(row + x0, &src->r, x1 - x0, layer->opacity_);
+    }
+  }
+}
+
+Layer::Rect Compositor::TakeTargetRect(const Canvas *target) {
+  std::map<const Canvas*, Layer::Rect>::iterator found
+    = target_dirty_.find(target);
+  if (found == target_dirty_.end()) {
+    // Never seen this target: needs everything.
+    target_dirty_[target] = Layer::Rect();
+    return Layer::Rect(0, 0, width_, height_);
+  }
+  const Layer::Rect result = found->second;
+  found->second = Layer::Rect();
+  return result;
+}
+
+void Compositor::Compose(FrameCanvas *target) {
+  Update();
+  const Layer::Rect r = TakeTargetRect(target);
+  if (r.empty()) return;
+  for (int y = r.y0; y < r.y1; ++y) {
+    target->SetPixels(r.x0, y, r.x1 - r.x0, 1, &composed_[y * width_ + r.x0]);
+  }
+}
+
+void Compositor::Compose(Canvas *target) {
+  Update();
+  const Layer::Rect r = TakeTargetRect(target);
+  for (int y = r.y0; y < r.y1; ++y) {
+    const Color *row = &composed_[y * width_];
+    for (int x = r.x0; x < r.x1; ++x) {
+      target->SetPixel(x, y, row[x].r, row[x].g, row[x].b);
+    }
+  }
+}
+
+}  // namespace rgb_matrix
@@ -4,11 +4,13 @@
 #include "led-matrix.h"
 
 #include <cstddef>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
@@ -90,6 +92,7 @@ MemMapViewInput::MemMapViewInput(int fd) : buffer_(nullptr) {
   close(fd);
   if (buffer_ == MAP_FAILED) {
     perror("Can't mmmap()");
+    buffer_ = nullptr;
     return;
   }
   end_ = buffer_ + file_size;
@@ -101,7 +104,7 @@ MemMapViewInput::MemMapViewInput(int fd) : buffer_(nullptr) {
 
 void MemMapViewInput::Rewind() { pos_ = buffer_; }
 ssize_t MemMapViewInput::Read(void *buf, size_t count) {
-  if (pos_ + count >= end_) return -1;
+  if (pos_ + count > end_) return -1;
   memcpy(buf, pos_, count);
   pos_ += count;
   return count;
@@ -149,8 +152,7 @@ bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   h.magic = kFrameMagicValue;
   h.size = len;
   h.hold_time_us = hold_time_us;
-  FullAppend(io_, &h, sizeof(h));
-  return FullAppend(io_, data, len) == (ssize_t)len;
+  return FullAppend(io_, &h, sizeof(h)) && FullAppend(io_, data, len);
 }
 
 void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
@@ -236,4 +238,185 @@ bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
     header_frame_buffer_ = new char [ sizeof(FrameHeader) + header.buf_size ];
   return true;
 }
+
+static int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+StreamPlayer::StreamPlayer(RGBMatrix *matrix, FrameCanvas *canvas,
+                           int vsync_multiple)
+  : matrix_(matrix), canvas_(canvas), vsync_multiple_(vsync_multiple),
+    next_frame_nanos_(0) {}
+
+bool StreamPlayer::Play(StreamReader *reader, int timeout_ms,
+                        long *frame_count) {
+  // If we're much later than planned, e.g. because there was a pause
+  // between calls, don't rush through frames to catch up.
+  static const int64_t kMaxLateNanos = 100 * 1000000LL;
+  const int64_t deadline = timeout_ms < 0
+    ? INT64_MAX : NowNanos() + timeout_ms * 1000000LL;
+  for (;;) {
+    const int64_t wait_until = std::min(next_frame_nanos_, deadline);
+    const struct timespec until = { (time_t)(wait_until / 1000000000LL),
+                                    (long)(wait_until % 1000000000LL) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+    const int64_t now = NowNanos();
+    if (now < next_frame_nanos_) return false;  // Frame shown still due.
+    if (now - next_frame_nanos_ > kMaxLateNanos) next_frame_nanos_ = now;
+
+    uint32_t hold_time_us;
+    if (!reader->GetNext(canvas_, &hold_time_us)) return true;
+    FrameCanvas *const previous = matrix_->SwapOnVSync(canvas_,
+                                                       vsync_multiple_);
+    if (previous) canvas_ = previous;  // NULL: no hardware to show it.
+    next_frame_nanos_ += hold_time_us * 1000LL;
+    if (frame_count) ++*frame_count;
+    if (NowNanos() >= deadline) return false;
+  }
+}
+
+StreamCacheEntry::StreamCacheEntry(const std::string &path,
+                                   const std::string &temp_path, int fd)
+  : path_(path), temp_path_(temp_path), io_(new FileStreamIO(fd)),
+    write_failed_(false) {}
+
+StreamCacheEntry::~StreamCacheEntry() {
+  if (io_) {
+    delete io_;
+    unlink(temp_path_.c_str());
+  }
+}
+
+bool StreamCacheEntry::Commit() {
+  if (!io_) return false;
+  delete io_;  // Closes the file.
+  io_ = NULL;
+  if (write_failed_) {
+    // E.g. the disk is full. A truncated stream would be shown from now on.
+    fprintf(stderr, "Not storing incomplete stream in cache\n");
+    unlink(temp_path_.c_str());
+    return false;
+  }
+  // Replacing the file is atomic; readers of a previous version keep
+  // reading that.
+  if (rename(temp_path_.c_str(), path_.c_str()) < 0) {
+    perror("Can't store stream in cache");
+    unlink(temp_path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void StreamCacheEntry::Rewind() { if (io_) io_->Rewind(); }
+ssize_t StreamCacheEntry::Read(void *buf, size_t count) {
+  return io_ ? io_->Read(buf, count) : -1;
+}
+ssize_t StreamCacheEntry::Append(const void *buf, size_t count) {
+  const ssize_t written = io_ ? io_->Append(buf, count) : -1;
+  if (written < (ssize_t)count) write_failed_ = true;
+  return written;
+}
+
+StreamCache::StreamCache(const std::string &directory)
+  : directory_(directory) {
+  if (mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "Can't create cache directory %s: %s\n",
+            directory_.c_str(), strerror(errno));
+  }
+}
+
+// FNV-1a; fast, and good enough to tell files apart.
+static uint64_t HashBytes(uint64_t hash, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::string StreamCache::MakeKey(const char *filename,
+                                 const RGBMatrix::Options &options,
+                                 const std::string &tool_options) {
+  // Reading all of a large video on each start would take about as long as
+  // decoding it, so the file is identified by its size, modification time
+  // and the content at its beginning and end.
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) return "";
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    close(fd);
+    return "";
+  }
+  const uint64_t file_info[3] = { (uint64_t)sb.st_size,
+                                  (uint64_t)sb.st_mtim.tv_sec,
+                                  (uint64_t)sb.st_mtim.tv_nsec };
+  uint64_t hash = HashBytes(0xcbf29ce484222325ULL,
+                            (const uint8_t*)file_info, sizeof(file_info));
+  static const off_t kSampleSize = 1 << 20;
+  const off_t tail_start = std::max(sb.st_size - kSampleSize, kSampleSize);
+  uint8_t buffer[65536];
+  ssize_t len = 0;
+  for (off_t pos = 0; pos < sb.st_size; pos += len) {
+    if (pos >= kSampleSize && pos < tail_start) pos = tail_start;
+    len = pread(fd, buffer, sizeof(buffer), pos);
+    if (len <= 0) break;
+    hash = HashBytes(hash, buffer, len);
+  }
+  close(fd);
+  if (len < 0) return "";
+
+  // Everything that changes the bits in the frame buffer.
+  char matrix_options[512];
+  snprintf(matrix_options, sizeof(matrix_options),
+           "map=%s;rows=%d;cols=%d;chain=%d;parallel=%d;pwm=%d;"
+           "brightness=%d;scan=%d;addr=%d;mux=%d;inverse=%d;seq=%s;"
+           "mapper=%s;wide=%d;",
+           options.hardware_mapping ? options.hardware_mapping : "",
+           options.rows, options.cols, options.chain_length, options.parallel,
+           options.pwm_bits, options.brightness,
+           options.scan_mode, options.row_address_type, options.multiplexing,
+           options.inverse_colors,
+           options.led_rgb_sequence ? options.led_rgb_sequence : "",
+           options.pixel_mapper_config ? options.pixel_mapper_config : "",
+           (int)sizeof(gpio_bits_t));
+  const std::string all_options = matrix_options + tool_options;
+  hash = HashBytes(hash, (const uint8_t*)all_options.data(),
+                   all_options.size());
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+  return key;
+}
+
+std::string StreamCache::Path(const std::string &key) const {
+  return directory_ + "/" + key + ".stream";
+}
+
+StreamIO *StreamCache::Open(const std::string &key, bool do_mmap) const {
+  if (key.empty()) return NULL;
+  const std::string path = Path(key);
+  if (do_mmap) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return NULL;
+    MemMapViewInput *input = new MemMapViewInput(fd);  // Takes the fd.
+    if (input->IsInitialized()) return input;
+    delete input;  // Fall back to reading the file.
+  }
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return NULL;
+  return new FileStreamIO(fd);
+}
+
+StreamCacheEntry *StreamCache::CreateEntry(const std::string &key) const {
+  if (key.empty()) return NULL;
+  const std::string path = Path(key);
+  const std::string temp_path = path + "." + std::to_string(getpid());
+  const int fd = open(temp_path.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Can't write to cache %s: %s\n",
+            temp_path.c_str(), strerror(errno));
+    return NULL;
+  }
+  return new StreamCacheEntry(path, temp_path, fd);
+}
 }  // namespace rgb_matrix
@@ -0,0 +1,289 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "draw-context.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+namespace rgb_matrix {
+
+// Cohen-Sutherland region codes.
+enum {
+  kInside = 0,
+  kLeft   = 1,
+  kRight  = 2,
+  kTop    = 4,
+  kBottom = 8,
+};
+
+DrawContext::DrawContext(Canvas *canvas) : canvas_(canvas) {
+  ResetClipRect();
+}
+
+void DrawContext::ResetClipRect() {
+  clip_x0_ = 0;
+  clip_y0_ = 0;
+  clip_x1_ = canvas_->width() - 1;
+  clip_y1_ = canvas_->height() - 1;
+}
+
+void DrawContext::SetClipRect(int x, int y, int width, int height) {
+  ResetClipRect();
+  clip_x0_ = std::max(clip_x0_, x);
+  clip_y0_ = std::max(clip_y0_, y);
+  clip_x1_ = std::min(clip_x1_, x + width - 1);
+  clip_y1_ = std::min(clip_y1_, y + height - 1);
+}
+
+void DrawContext::SetPixel(int x, int y, const Color &color) {
+  if (x < clip_x0_ || x > clip_x1_ || y < clip_y0_ || y > clip_y1_)
+    return;
+  canvas_->SetPixel(x, y, color.r, color.g, color.b);
+}
+
+void DrawContext::HorizontalSpan(int x0, int x1, int y, const Color &color) {
+  if (y < clip_y0_ || y > clip_y1_) return;
+  x0 = std::max(x0, clip_x0_);
+  x1 = std::min(x1, clip_x1_);
+  if (x0 > x1) return;
+  canvas_->SubFill(x0, y, x1 - x0 + 1, 1, color.r, color.g, color.b);
+}
+
+void DrawContext::VerticalSpan(int x, int y0, int y1, const Color &color) {
+  if (x < clip_x0_ || x > clip_x1_) return;
+  y0 = std::max(y0, clip_y0_);
+  y1 = std::min(y1, clip_y1_);
+  if (y0 > y1) return;
+  canvas_->SubFill(x, y0, 1, y1 - y0 + 1, color.r, color.g, color.b);
+}
+
+void DrawContext::FillRect(int x, int y, int width, int height,
+                           const Color &color) {
+  const int x0 = std::max(x, clip_x0_);
+  const int y0 = std::max(y, clip_y0_);
+  const int x1 = std::min(x + width - 1, clip_x1_);
+  const int y1 = std::min(y + height - 1, clip_y1_);
+  if (x0 > x1 || y0 > y1) return;
+  canvas_->SubFill(x0, y0, x1 - x0 + 1, y1 - y0 + 1,
+                   color.r, color.g, color.b);
+}
+
+void DrawContext::DrawRect(int x, int y, int width, int height,
+                           const Color &color) {
+  if (width <= 0 || height <= 0) return;
+  HorizontalSpan(x, x + width - 1, y, color);
+  if (height > 1) HorizontalSpan(x, x + width - 1, y + height - 1, color);
+  FillRect(x, y + 1, 1, height - 2, color);
+  if (width > 1) FillRect(x + width - 1, y + 1, 1, height - 2, color);
+}
+
+void DrawContext::DrawLine(int x0, int y0, int x1, int y1,
+                           const Color &color) {
+  // Trivial reject if both ends are outside on the same side.
+  const int code0 = ((x0 < clip_x0_) ? kLeft : (x0 > clip_x1_) ? kRight : 0)
+    | ((y0 < clip_y0_) ? kTop : (y0 > clip_y1_) ? kBottom : 0);
+  const int code1 = ((x1 < clip_x0_) ? kLeft : (x1 > clip_x1_) ? kRight : 0)
+    | ((y1 < clip_y0_) ? kTop : (y1 > clip_y1_) ? kBottom : 0);
+  if (code0 & code1)
+    return;
+
+  // Same fixed-point stepping as the original per-pixel DrawLine(), but only
+  // over the visible range of the major axis; consecutive pixels on the
+  // same minor coordinate are emitted as one span.
+  const int shift = 16;
+  const int dy = y1 - y0, dx = x1 - x0;
+  if (abs(dx) > abs(dy)) {
+    if (x1 < x0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    const int64_t gradient = ((int64_t)(y1 - y0) << shift) / (x1 - x0);
+    const int x_start = std::max(x0, clip_x0_);
+    const int x_end = std::min(x1, clip_x1_);
+    int64_t y = 0x8000 + ((int64_t)y0 << shift)
+      + gradient * (x_start - x0);
+    int run_start = x_start;
+    int run_y = y >> shift;
+    for (int x = x_start; x <= x_end; ++x, y += gradient) {
+      const int py = y >> shift;
+      if (py == run_y) continue;
+      HorizontalSpan(run_start, x - 1, run_y, color);
+      run_start = x;
+      run_y = py;
+    }
+    HorizontalSpan(run_start, x_end, run_y, color);
+  } else if (dy != 0) {
+    if (y1 < y0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    const int64_t gradient = ((int64_t)(x1 - x0) << shift) / (y1 - y0);
+    const int y_start = std::max(y0, clip_y0_);
+    const int y_end = std::min(y1, clip_y1_);
+    int64_t x = 0x8000 + ((int64_t)x0 << shift)
+      + gradient * (y_start - y0);
+    int run_start = y_start;
+    int run_x = x >> shift;
+    for (int y = y_start; y <= y_end; ++y, x += gradient) {
+      const int px = x >> shift;
+      if (px == run_x) continue;
+      VerticalSpan(run_x, run_start, y - 1, color);
+      run_start = y;
+      run_x = px;
+    }
+    VerticalSpan(run_x, run_start, y_end, color);
+  } else {
+    SetPixel(x0, y0, color);
+  }
+}
+
+void DrawContext::DrawThickLine(int x0, int y0, int x1, int y1, int thickness,
+                                const Color &color) {
+  if (thickness <= 1) {
+    DrawLine(x0, y0, x1, y1, color);
+    return;
+  }
+  const double half = thickness / 2.0;
+  const double dx = x1 - x0, dy = y1 - y0;
+  const double length = sqrt(dx * dx + dy * dy);
+  if (length == 0) {
+    FillRect(x0 - thickness / 2, y0 - thickness / 2, thickness, thickness,
+             color);
+    return;
+  }
+  // Rectangle around the line through the pixel centers, extended by half
+  // the thickness at both ends, so that polylines have closed joints.
+  const double ux = dx / length * half, uy = dy / length * half;
+  const double cx0 = x0 + 0.5 - ux, cy0 = y0 + 0.5 - uy;
+  const double cx1 = x1 + 0.5 + ux, cy1 = y1 + 0.5 + uy;
+  const Vertex quad[4] = {
+    { cx0 - uy, cy0 + ux }, { cx1 - uy, cy1 + ux },
+    { cx1 + uy, cy1 - ux }, { cx0 + uy, cy0 - ux },
+  };
+  FillVertices(quad, 4, color);
+}
+
+void DrawContext::DrawPolyline(const Point *points, int count, bool closed,
+                               const Color &color, int thickness) {
+  if (count <= 0) return;
+  for (int i = 0; i + 1 < count; ++i) {
+    DrawThickLine(points[i].x, points[i].y, points[i+1].x, points[i+1].y,
+                  thickness, color);
+  }
+  if (closed && count > 2) {
+    DrawThickLine(points[count-1].x, points[count-1].y,
+                  points[0].x, points[0].y, thickness, color);
+  } else if (count == 1) {
+    DrawThickLine(points[0].x, points[0].y, points[0].x, points[0].y,
+                  thickness, color);
+  }
+}
+
+void DrawContext::DrawCircle(int x0, int y0, int radius, const Color &color) {
+  if (x0 + radius < clip_x0_ || x0 - radius > clip_x1_
+      || y0 + radius < clip_y0_ || y0 - radius > clip_y1_)
+    return;
+  int x = radius, y = 0;
+  int radiusError = 1 - x;
+
+  while (y <= x) {
+    SetPixel(x + x0, y + y0, color);
+    SetPixel(y + x0, x + y0, color);
+    SetPixel(-x + x0, y + y0, color);
+    SetPixel(-y + x0, x + y0, color);
+    SetPixel(-x + x0, -y + y0, color);
+    SetPixel(-y + x0, -x + y0, color);
+    SetPixel(x + x0, -y + y0, color);
+    SetPixel(y + x0, -x + y0, color);
+    y++;
+    if (radiusError<0){
+      radiusError += 2 * y + 1;
+    } else {
+      x--;
+      radiusError+= 2 * (y - x + 1);
+    }
+  }
+}
+
+void DrawContext::FillCircle(int x0, int y0, int radius, const Color &color) {
+  if (radius < 0 || x0 + radius < clip_x0_ || x0 - radius > clip_x1_
+      || y0 + radius < clip_y0_ || y0 - radius > clip_y1_)
+    return;
+  // Same stepping as DrawCircle(); each row is filled between the outline
+  // pixels, and only once.
+  int x = radius, y = 0;
+  int radiusError = 1 - x;
+
+  while (y <= x) {
+    HorizontalSpan(x0 - x, x0 + x, y0 + y, color);
+    if (y != 0) HorizontalSpan(x0 - x, x0 + x, y0 - y, color);
+    if (radiusError >= 0 && x != y) {
+      // Last time we see rows +/- x: fill them at their widest.
+      HorizontalSpan(x0 - y, x0 + y, y0 + x, color);
+      HorizontalSpan(x0 - y, x0 + y, y0 - x, color);
+    }
+    y++;
+    if (radiusError<0){
+      radiusError += 2 * y + 1;
+    } else {
+      x--;
+      radiusError+= 2 * (y - x + 1);
+    }
+  }
+}
+
+void DrawContext::FillPolygon(const Point *points, int count,
+                              const Color &color) {
+  if (count < 3) return;
+  vertices_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    vertices_[i].x = points[i].x;
+    vertices_[i].y = points[i].y;
+  }
+  FillVertices(vertices_.data(), count, color);
+}
+
+void DrawContext::FillVertices(const Vertex *v, int count,
+                               const Color &color) {
+  double min_y = v[0].y, max_y = v[0].y;
+  for (int i = 1; i < count; ++i) {
+    min_y = std::min(min_y, v[i].y);
+    max_y = std::max(max_y, v[i].y);
+  }
+  // Rows whose pixel centers are within the polygon's vertical extent.
+  const int y_start = std::max((int)ceil(min_y - 0.5), clip_y0_);
+  const int y_end = std::min((int)ceil(max_y - 0.5) - 1, clip_y1_);
+
+  for (int y = y_start; y <= y_end; ++y) {
+    const double center = y + 0.5;
+    crossings_.clear();
+    for (int i = 0, j = count - 1; i < count; j = i++) {
+      if ((v[i].y <= center) == (v[j].y <= center))
+        continue;  // Edge does not cross this row.
+      crossings_.push_back(v[j].x + (center - v[j].y)
+                           * (v[i].x - v[j].x) / (v[i].y - v[j].y));
+    }
+    std::sort(crossings_.begin(), crossings_.end());
+    for (size_t i = 0; i + 1 < crossings_.size(); i += 2) {
+      HorizontalSpan((int)ceil(crossings_[i] - 0.5),
+                     (int)ceil(crossings_[i+1] - 0.5) - 1, y, color);
+    }
+  }
+}
+
+}  // namespace rgb_matrix
@@ -0,0 +1,328 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "frame-server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace rgb_matrix {
+namespace internal {
+// Layout of the shared memory: the header, then the channels, then three
+// frame buffers per channel. All parts start at multiples of 64 bytes.
+//
+// Each channel is a triple buffer without locks: the producer draws into
+// one buffer, the server shows another one, and "latest" holds the most
+// recently submitted one. Both sides only ever swap their buffer with
+// "latest" atomically.
+static const char kMagic[8] = "RGBSHM1";
+static const uint32_t kFresh = 0x4;    // Flag in "latest": not taken yet.
+
+struct SharedFrameHeader {
+  char magic[8];
+  uint32_t width, height, channels;
+  uint32_t frame_size;          // Bytes per buffer.
+  uint32_t submissions;         // Counter, also used as futex.
+  uint32_t reserved[9];
+};
+
+struct SharedFrameChannel {
+  uint32_t owner;               // Process ID of the producer; 0: free.
+  uint32_t latest;              // Buffer index, maybe with kFresh.
+  uint32_t producer_buffer;     // Buffer index the producer draws into.
+  uint32_t reserved[13];
+};
+}  // namespace internal
+
+using internal::SharedFrameHeader;
+using internal::SharedFrameChannel;
+using internal::kFresh;
+
+static size_t ChannelsOffset() { return sizeof(SharedFrameHeader); }
+static size_t BuffersOffset(int channels) {
+  return ChannelsOffset() + channels * sizeof(SharedFrameChannel);
+}
+static size_t FrameSize(int width, int height) {
+  return ((size_t)width * height * 4 + 63) & ~(size_t)63;
+}
+static size_t SharedSize(int width, int height, int channels) {
+  return BuffersOffset(channels) + 3 * channels * FrameSize(width, height);
+}
+
+static SharedFrameChannel *GetChannel(SharedFrameHeader *header, int c) {
+  return (SharedFrameChannel*)((char*)header + ChannelsOffset()) + c;
+}
+static uint8_t *GetBuffer(SharedFrameHeader *header, int c, int index) {
+  return (uint8_t*)header + BuffersOffset(header->channels)
+    + (3 * c + index) * (size_t)header->frame_size;
+}
+
+static void FutexWait(uint32_t *address, uint32_t value, int timeout_ms) {
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, address, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void FutexWakeAll(uint32_t *address) {
+  syscall(SYS_futex, address, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+FrameServer *FrameServer::Create(const char *name, int width, int height,
+                                 int channels) {
+  if (width <= 0 || height <= 0 || channels <= 0) {
+    fprintf(stderr, "Invalid frame server size %dx%d, %d channels\n",
+            width, height, channels);
+    return NULL;
+  }
+  shm_unlink(name);  // Left over from a server that didn't exit cleanly.
+  const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd < 0) {
+    perror("Can't create shared memory");
+    return NULL;
+  }
+  fchmod(fd, 0666);  // Producers might run as any user; ignore umask.
+  const size_t size = SharedSize(width, height, channels);
+  if (ftruncate(fd, size) < 0) {
+    perror("Can't size shared memory");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    perror("Can't map shared memory");
+    shm_unlink(name);
+    return NULL;
+  }
+  return new FrameServer(name, width, height, channels, memory, size);
+}
+
+FrameServer::FrameServer(const std::string &name, int width, int height,
+                         int channels, void *memory, size_t size)
+  : name_(name), width_(width), height_(height), channels_(channels),
+    frame_size_(FrameSize(width, height)),
+    memory_(memory), size_(size), header_((SharedFrameHeader*)memory),
+    front_(channels, 0) {
+  memset(memory_, 0, size_);
+  header_->width = width;
+  header_->height = height;
+  header_->channels = channels;
+  header_->frame_size = frame_size_;
+  for (int c = 0; c < channels_; ++c) {
+    channel(c)->latest = 1;
+    channel(c)->producer_buffer = 2;
+  }
+  // Producers check the magic last, so only see a fully set-up memory.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header_->magic, internal::kMagic, sizeof(header_->magic));
+}
+
+FrameServer::~FrameServer() {
+  munmap(memory_, size_);
+  shm_unlink(name_.c_str());
+}
+
+SharedFrameChannel *FrameServer::channel(int c) {
+  return GetChannel(header_, c);
+}
+
+// Producers can write anything into the shared memory, so this only uses
+// what the server knows itself.
+uint8_t *FrameServer::buffer(int c, int index) {
+  return (uint8_t*)memory_ + BuffersOffset(channels_)
+    + (3 * c + index) * frame_size_;
+}
+
+void FrameServer::ResetChannel(int c) {
+  SharedFrameChannel *const ch = channel(c);
+  __atomic_store_n(&ch->latest, (front_[c] + 1) % 3, __ATOMIC_RELAXED);
+  __atomic_store_n(&ch->producer_buffer, (front_[c] + 2) % 3,
+                   __ATOMIC_RELAXED);
+}
+
+void FrameServer::WaitForFrames(int timeout_ms) {
+  const uint32_t submissions
+    = __atomic_load_n(&header_->submissions, __ATOMIC_ACQUIRE);
+  for (int c = 0; c < channels_; ++c) {
+    // A producer that submits and exits wakes us once; after that, a frame
+    // nobody takes must not keep us from sleeping.
+    SharedFrameChannel *const ch = channel(c);
+    if ((__atomic_load_n(&ch->latest, __ATOMIC_ACQUIRE) & kFresh)
+        && __atomic_load_n(&ch->owner, __ATOMIC_ACQUIRE) != 0)
+      return;
+  }
+  // Returns right away if another frame was submitted in the meantime.
+  FutexWait(&header_->submissions, submissions, timeout_ms);
+}
+
+bool FrameServer::TakeFrame(int c, const uint8_t **rgba) {
+  if (c < 0 || c >= channels_) return false;
+  SharedFrameChannel *const ch = channel(c);
+  if (!(__atomic_load_n(&ch->latest, __ATOMIC_ACQUIRE) & kFresh))
+    return false;
+  const uint32_t taken = __atomic_exchange_n(&ch->latest, front_[c],
+                                             __ATOMIC_ACQ_REL) & ~kFresh;
+  if (taken > 2) {
+    // Not a buffer index; the producer is broken. Keep showing what we
+    // have and release the channel as if the producer had died.
+    ResetChannel(c);
+    __atomic_store_n(&ch->owner, 0, __ATOMIC_RELEASE);
+    return false;
+  }
+  front_[c] = taken;
+  *rgba = buffer(c, front_[c]);
+  return true;
+}
+
+bool FrameServer::IsActive(int c) {
+  if (c < 0 || c >= channels_) return false;
+  SharedFrameChannel *const ch = channel(c);
+  uint32_t owner = __atomic_load_n(&ch->owner, __ATOMIC_ACQUIRE);
+  if (owner == 0) return false;
+  if (kill(owner, 0) == 0 || errno != ESRCH)
+    return true;
+
+  // The producer died without releasing the channel. Its buffers might
+  // be in any state, so set up the buffers we don't show afresh before
+  // anyone else can claim the channel.
+  ResetChannel(c);
+  __atomic_compare_exchange_n(&ch->owner, &owner, 0, false,
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  return false;
+}
+
+FrameProducer *FrameProducer::Connect(const char *name, int channel) {
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open shared memory %s: %s. Is the frame server "
+            "running?\n", name, strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SharedFrameHeader)) {
+    fprintf(stderr, "Shared memory %s is not from a frame server.\n", name);
+    close(fd);
+    return NULL;
+  }
+  void *memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    perror("Can't map shared memory");
+    return NULL;
+  }
+  SharedFrameHeader *const header = (SharedFrameHeader*)memory;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (memcmp(header->magic, internal::kMagic, sizeof(header->magic)) != 0
+      || SharedSize(header->width, header->height, header->channels)
+         != (size_t)st.st_size) {
+    fprintf(stderr, "Shared memory %s is not from a compatible frame "
+            "server.\n", name);
+    munmap(memory, st.st_size);
+    return NULL;
+  }
+
+  // Claim the channel.
+  const uint32_t pid = getpid();
+  const int first = (channel < 0) ? 0 : channel;
+  const int last = (channel < 0) ? (int)header->channels - 1 : channel;
+  for (int c = first; c <= last && c < (int)header->channels; ++c) {
+    uint32_t free_owner = 0;
+    if (__atomic_compare_exchange_n(&GetChannel(header, c)->owner,
+                                    &free_owner, pid, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return new FrameProducer(header->width, header->height, c,
+                               memory, st.st_size);
+    }
+  }
+  if (channel < 0) {
+    fprintf(stderr, "All %d channels of %s are in use.\n",
+            header->channels, name);
+  } else {
+    fprintf(stderr, "Channel %d of %s is not available.\n", channel, name);
+  }
+  munmap(memory, st.st_size);
+  return NULL;
+}
+
+FrameProducer::FrameProducer(int width, int height, int channel,
+                             void *memory, size_t size)
+  : width_(width), height_(height), channel_(channel),
+    memory_(memory), size_(size), header_((SharedFrameHeader*)memory),
+    shared_channel_(GetChannel(header_, channel)) {
+  // A frame the previous owner submitted, but that was never shown, is
+  // not ours to show.
+  uint32_t latest = __atomic_load_n(&shared_channel_->latest,
+                                    __ATOMIC_ACQUIRE);
+  if (latest & kFresh) {
+    __atomic_compare_exchange_n(&shared_channel_->latest, &latest,
+                                latest & ~kFresh, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+  }
+  frame_ = GetBuffer(header_, channel_, shared_channel_->producer_buffer);
+}
+
+FrameProducer::~FrameProducer() {
+  __atomic_store_n(&shared_channel_->owner, 0, __ATOMIC_RELEASE);
+  FutexWakeAll(&header_->submissions);  // Let the server notice.
+  munmap(memory_, size_);
+}
+
+void FrameProducer::Submit() {
+  const uint32_t previous = __atomic_exchange_n(
+    &shared_channel_->latest, shared_channel_->producer_buffer | kFresh,
+    __ATOMIC_ACQ_REL);
+  shared_channel_->producer_buffer = previous & ~kFresh;
+  frame_ = GetBuffer(header_, channel_, shared_channel_->producer_buffer);
+  __atomic_fetch_add(&header_->submissions, 1, __ATOMIC_RELEASE);
+  FutexWakeAll(&header_->submissions);
+}
+
+void FrameProducer::SetPixel(int x, int y,
+                             uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  uint8_t *pixel = frame_ + 4 * (y * width_ + x);
+  pixel[0] = red;
+  pixel[1] = green;
+  pixel[2] = blue;
+  pixel[3] = 255;
+}
+
+void FrameProducer::Clear() {
+  memset(frame_, 0, (size_t)width_ * height_ * 4);
+}
+
+void FrameProducer::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  uint8_t *pixel = frame_;
+  for (int i = 0; i < width_ * height_; ++i, pixel += 4) {
+    pixel[0] = red;
+    pixel[1] = green;
+    pixel[2] = blue;
+    pixel[3] = 255;
+  }
+}
+
+}  // namespace rgb_matrix
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <atomic>
+
 #include "hardware-mapping.h"
 #include "../include/graphics.h"
 
@@ -88,6 +90,14 @@ public:
               int scan_mode,
               const char* led_sequence, bool inverse_color,
               PixelDesignatorMap **mapper);
+
+  // Create a framebuffer with rows of "virtual_columns", of which "columns"
+  // starting at the scroll_offset() are shown. Pixels are laid out like the
+  // corresponding rows in "display_mapper", which must consist of linear
+  // rows (see IsLinearRow()).
+  Framebuffer(int rows, int columns, int parallel,
+              int scan_mode, bool inverse_color,
+              PixelDesignatorMap *display_mapper, int virtual_columns);
   ~Framebuffer();
 
   // Initialize GPIO bits for output. Only call once.
@@ -121,6 +131,14 @@ public:
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
   void CopyFrom(const Framebuffer *other);
+  // Copy only the pixels of the given area; "other" needs to use the
+  // same mapping.
+  void CopyRegionFrom(const Framebuffer *other,
+                      int x, int y, int width, int height);
+
+  // Column shown first; only differs from zero in scrolling framebuffers.
+  void SetScrollOffset(int offset);
+  int scroll_offset() const { return scroll_offset_; }
 
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
@@ -128,10 +146,33 @@ public:
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
   void SetPixels(int x, int y, int width, int height, Color *colors);
+  void SetPixelBuffer(int x, int y, int width, int height,
+                      const uint8_t *pixels, int pixel_step, int stride,
+                      bool is_bgr);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
   void SubFill(int x, int y, int width, int height, uint8_t red, uint8_t green, uint8_t blue);
 
+  // -- Pre-encoded rows, used by the ScrollStrip.
+
+  // The mapping currently in use; identifies compatible encodings.
+  const PixelDesignatorMap *pixel_designator_map() const {
+    return *shared_mapper_;
+  }
+
+  // Returns true if all pixels of row "y" are stored in consecutive words
+  // with the same color bits, so that pre-encoded rows can be copied.
+  bool IsLinearRow(int y) const;
+
+  // Encode "count" pixels as they would be stored in the linear row "y".
+  // Output are pwmbits() planes of "count" words each in "encoded".
+  void EncodeRow(int y, const Color *pixels, int count, gpio_bits_t *encoded);
+
+  // Copy "count" pre-encoded pixels to columns starting at "x" of the
+  // linear row "y". Planes in "encoded" are "stride" words apart.
+  void CopyEncodedRow(int y, int x, int count,
+                      const gpio_bits_t *encoded, int stride);
+
 private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
@@ -151,6 +192,8 @@ private:
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
   const int columns_;  // Number of columns. Number of chained boards * 32.
+                       // (or more in scrolling framebuffers)
+  const int display_columns_;  // Number of columns clocked out.
 
   const int scan_mode_;
   const bool inverse_color_;
@@ -172,6 +215,9 @@ private:
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
 
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
+  PixelDesignatorMap *own_mapper_;      // Only used in scrolling framebuffer.
+
+  std::atomic<int> scroll_offset_;
 };
 }  // namespace internal
 }  // namespace rgb_matrix
@@ -329,12 +329,13 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     parallel_(parallel),
     height_(rows * parallel),
     columns_(columns),
+    display_columns_(columns),
     scan_mode_(scan_mode),
     inverse_color_(inverse_color),
     pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
     double_rows_(rows / SUB_PANELS_),
     buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
-    shared_mapper_(mapper) {
+    shared_mapper_(mapper), own_mapper_(NULL), scroll_offset_(0) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
   assert(rows_ >=4 && rows_ <= 64 && rows_ % 2 == 0);
@@ -380,8 +381,44 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   Clear();
 }
 
+Framebuffer::Framebuffer(int rows, int columns, int parallel,
+                         int scan_mode, bool inverse_color,
+                         PixelDesignatorMap *display_mapper,
+                         int virtual_columns)
+  : rows_(rows),
+    parallel_(parallel),
+    height_(rows * parallel),
+    columns_(virtual_columns),
+    display_columns_(columns),
+    scan_mode_(scan_mode),
+    inverse_color_(inverse_color),
+    pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    double_rows_(rows / SUB_PANELS_),
+    buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
+    shared_mapper_(&own_mapper_), own_mapper_(NULL), scroll_offset_(0) {
+  assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
+  assert(virtual_columns >= columns);
+  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+
+  // Same rows and color bits as on the display, just wider.
+  own_mapper_ = new PixelDesignatorMap(columns_, height_,
+                                       display_mapper->GetFillColorBits());
+  for (int y = 0; y < height_; ++y) {
+    const PixelDesignator *display = display_mapper->get(0, y);
+    const long double_row = display->gpio_word / (columns * kBitPlanes);
+    for (int x = 0; x < columns_; ++x) {
+      PixelDesignator *d = own_mapper_->get(x, y);
+      *d = *display;
+      d->gpio_word = ValueAt(double_row, x, 0) - bitplane_buffer_;
+    }
+  }
+
+  Clear();
+}
+
 Framebuffer::~Framebuffer() {
   delete [] bitplane_buffer_;
+  delete own_mapper_;
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -725,33 +762,48 @@ void Framebuffer::SubFill(int x, int y, int width, int height, uint8_t r, uint8_
   int safe_y_max = std::min((*shared_mapper_)->height(), y + height);
   int safe_x = std::max(0, x);
   int safe_x_max = std::min((*shared_mapper_)->width(), x + width);
+  if (safe_x >= safe_x_max) return;
+
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+
+  // Neighboring pixels typically share the same color bits (same sub-panel
+  // and parallel chain), so we only re-calculate the bits per plane if they
+  // change. This keeps the inner loop to a simple masked store per plane.
+  gpio_bits_t plane_bits[kBitPlanes];
+  gpio_bits_t last_r = 0, last_g = 0, last_b = 0;
+  bool have_plane_bits = false;
 
   for (int row = safe_y; row < safe_y_max; row++)
   {
     const PixelDesignator* designator = (*shared_mapper_)->get(safe_x, row);
 
-    for (int col = safe_x; col < safe_x_max; col++)
+    for (int col = safe_x; col < safe_x_max; col++, designator++)
     {
-      if (designator == NULL) continue;
       const long pos = designator->gpio_word;
       if (pos < 0) continue;  // non-used pixel marker.
 
-      gpio_bits_t* bits = bitplane_buffer_ + pos;
-      const int min_bit_plane = kBitPlanes - pwm_bits_;
-      bits += (columns_ * min_bit_plane);
-      const gpio_bits_t r_bits = designator->r_bit;
-      const gpio_bits_t g_bits = designator->g_bit;
-      const gpio_bits_t b_bits = designator->b_bit;
+      if (!have_plane_bits || designator->r_bit != last_r
+          || designator->g_bit != last_g || designator->b_bit != last_b) {
+        last_r = designator->r_bit;
+        last_g = designator->g_bit;
+        last_b = designator->b_bit;
+        for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+          const uint16_t mask = 1 << p;
+          gpio_bits_t color_bits = 0;
+          if (red & mask)   color_bits |= last_r;
+          if (green & mask) color_bits |= last_g;
+          if (blue & mask)  color_bits |= last_b;
+          plane_bits[p] = color_bits;
+        }
+        have_plane_bits = true;
+      }
+
+      gpio_bits_t* bits = bitplane_buffer_ + pos + (columns_ * min_bit_plane);
       const gpio_bits_t designator_mask = designator->mask;
-      for (uint16_t mask = 1 << min_bit_plane; mask != 1 << kBitPlanes; mask <<= 1) {
-        gpio_bits_t color_bits = 0;
-        if (red & mask)   color_bits |= r_bits;
-        if (green & mask) color_bits |= g_bits;
-        if (blue & mask)  color_bits |= b_bits;
-        *bits = (*bits & designator_mask) | color_bits;
+      for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+        *bits = (*bits & designator_mask) | plane_bits[p];
         bits += columns_;
       }
-      designator++;
     }
   }
 }
@@ -785,11 +837,106 @@ void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   }
 }
 
+bool Framebuffer::IsLinearRow(int y) const {
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (y < 0 || y >= mapper->height()) return false;
+  const PixelDesignator *const first = mapper->get(0, y);
+  if (first->gpio_word < 0) return false;
+  for (int x = 1; x < mapper->width(); ++x) {
+    const PixelDesignator *d = first + x;
+    if (d->gpio_word != first->gpio_word + x
+        || d->r_bit != first->r_bit || d->g_bit != first->g_bit
+        || d->b_bit != first->b_bit || d->mask != first->mask)
+      return false;
+  }
+  return true;
+}
+
+void Framebuffer::EncodeRow(int y, const Color *pixels, int count,
+                            gpio_bits_t *encoded) {
+  const PixelDesignator *designator = (*shared_mapper_)->get(0, y);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (int i = 0; i < count; ++i) {
+    uint16_t red, green, blue;
+    MapColors(pixels[i].r, pixels[i].g, pixels[i].b, &red, &green, &blue);
+    gpio_bits_t *out = encoded + i;
+    for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+      const uint16_t mask = 1 << p;
+      gpio_bits_t color_bits = 0;
+      if (red & mask)   color_bits |= designator->r_bit;
+      if (green & mask) color_bits |= designator->g_bit;
+      if (blue & mask)  color_bits |= designator->b_bit;
+      *out = color_bits;
+      out += count;
+    }
+  }
+}
+
+void Framebuffer::CopyEncodedRow(int y, int x, int count,
+                                 const gpio_bits_t *encoded, int stride) {
+  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  if (designator == NULL || count <= 0) return;
+  const gpio_bits_t designator_mask = designator->mask;
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  gpio_bits_t *bits = bitplane_buffer_ + designator->gpio_word
+    + columns_ * min_bit_plane;
+  for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+    // Rows share words with the other half of the panel, so this is a
+    // masked copy.
+    for (int i = 0; i < count; ++i) {
+      bits[i] = (bits[i] & designator_mask) | encoded[i];
+    }
+    bits += columns_;
+    encoded += stride;
+  }
+}
+
 void Framebuffer::SetPixels(int x, int y, int width, int height, Color *colors) {
-  for (int iy = 0; iy < height; ++iy) {
-    for (int ix = 0; ix < width; ++ix) {
-      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
-      ++colors;
+  static_assert(sizeof(Color) == 3, "Color expected to be packed RGB");
+  SetPixelBuffer(x, y, width, height, &colors->r, sizeof(Color),
+                 width * sizeof(Color), false);
+}
+
+void Framebuffer::SetPixelBuffer(int x, int y, int width, int height,
+                                 const uint8_t *pixels, int pixel_step,
+                                 int stride, bool is_bgr) {
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int x_start = std::max(0, x);
+  const int x_end = std::min(mapper->width(), x + width);
+  const int y_start = std::max(0, y);
+  const int y_end = std::min(mapper->height(), y + height);
+  if (x_start >= x_end) return;
+  const int r_offset = is_bgr ? 2 : 0;
+  const int b_offset = is_bgr ? 0 : 2;
+
+  // Same as SetPixel() for each pixel, but walking the designators of a row
+  // linearly, so color mapping and writing the bitplanes is a single pass
+  // over the row.
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (int row = y_start; row < y_end; ++row) {
+    const uint8_t *pixel = pixels + (long)(row - y) * stride
+      + (long)(x_start - x) * pixel_step;
+    const PixelDesignator *designator = mapper->get(x_start, row);
+    for (int col = x_start; col < x_end;
+         ++col, pixel += pixel_step, ++designator) {
+      const long pos = designator->gpio_word;
+      if (pos < 0) continue;  // non-used pixel marker.
+
+      uint16_t red, green, blue;
+      MapColors(pixel[r_offset], pixel[1], pixel[b_offset],
+                &red, &green, &blue);
+
+      gpio_bits_t *bits = bitplane_buffer_ + pos + (columns_ * min_bit_plane);
+      const gpio_bits_t designator_mask = designator->mask;
+      for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+        const uint16_t mask = 1 << p;
+        gpio_bits_t color_bits = 0;
+        if (red & mask)   color_bits |= designator->r_bit;
+        if (green & mask) color_bits |= designator->g_bit;
+        if (blue & mask)  color_bits |= designator->b_bit;
+        *bits = (*bits & designator_mask) | color_bits;
+        bits += columns_;
+      }
     }
   }
 }
@@ -903,10 +1050,45 @@ bool Framebuffer::Deserialize(const char *data, size_t len) {
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
-  if (other == this) return;
+  if (other == this || other->buffer_size_ != buffer_size_) return;
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
 }
 
+void Framebuffer::CopyRegionFrom(const Framebuffer *other,
+                                 int x, int y, int width, int height) {
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (other == this || other->pixel_designator_map() != mapper) return;
+  const int x_start = std::max(0, x);
+  const int x_end = std::min(mapper->width(), x + width);
+  const int y_start = std::max(0, y);
+  const int y_end = std::min(mapper->height(), y + height);
+
+  // Like SubFill(), but the color bits of each plane come from the other
+  // buffer instead of a color, so no mapping of colors is needed.
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const size_t plane_offset = columns_ * min_bit_plane;
+  for (int row = y_start; row < y_end; ++row) {
+    const PixelDesignator *designator = mapper->get(x_start, row);
+    for (int col = x_start; col < x_end; ++col, ++designator) {
+      const long pos = designator->gpio_word;
+      if (pos < 0) continue;  // non-used pixel marker.
+      gpio_bits_t *bits = bitplane_buffer_ + pos + plane_offset;
+      const gpio_bits_t *from = other->bitplane_buffer_ + pos + plane_offset;
+      const gpio_bits_t designator_mask = designator->mask;
+      for (int p = min_bit_plane; p < kBitPlanes; ++p) {
+        *bits = (*bits & designator_mask) | (*from & ~designator_mask);
+        bits += columns_;
+        from += columns_;
+      }
+    }
+  }
+}
+
+void Framebuffer::SetScrollOffset(int offset) {
+  offset %= columns_;
+  scroll_offset_ = (offset < 0) ? offset + columns_ : offset;
+}
+
 void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
   const struct HardwareMapping &h = *hardware_mapping_;
   gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
@@ -932,6 +1114,9 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
   // Depending if we do dithering, we might not always show the lowest bits.
   const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
 
+  // Read once, so that all rows of this refresh show the same window.
+  const int scroll_offset = scroll_offset_;
+
   const uint8_t half_double = double_rows_/2;
   for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
     uint8_t d_row;
@@ -950,13 +1135,21 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
     for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+      gpio_bits_t *const row_start = ValueAt(d_row, 0, b);
       // While the output enable is still on, we can already clock in the next
       // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+      // In scrolling framebuffers, we start at the scroll offset and wrap
+      // around at the end of the row; otherwise this is just one segment.
+      int column = scroll_offset;
+      for (int col = 0; col < display_columns_; column = 0) {
+        const gpio_bits_t *row_data = row_start + column;
+        const int segment_end = std::min(display_columns_,
+                                         col + columns_ - column);
+        for (/**/; col < segment_end; ++col) {
+          const gpio_bits_t &out = *row_data++;
+          io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
+          io->SetBits(h.clock);               // Rising edge: clock color in.
+        }
       }
       io->ClearBits(color_clk_mask);    // clock back to normal.
 
@@ -14,8 +14,11 @@
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
 #include "graphics.h"
+#include "draw-context.h"
 #include "utf8-internal.h"
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <functional>
 #include <algorithm>
@@ -28,52 +31,13 @@ bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
   if (3 * width * height != (int)size)   // Sanity check
     return false;
 
-  int image_display_w = width;
-  int image_display_h = height;
+  // Nothing to show if the image is completely left of or above the canvas.
+  if (canvas_offset_x + width <= 0 || canvas_offset_y + height <= 0)
+    return false;
 
-  size_t skip_start_row = 0;   // Bytes to skip before each row
-  if (canvas_offset_x < 0) {
-    skip_start_row = -canvas_offset_x * 3;
-    image_display_w += canvas_offset_x;
-    if (image_display_w <= 0) return false;  // Done. outside canvas.
-    canvas_offset_x = 0;
-  }
-  if (canvas_offset_y < 0) {
-    // Skip buffer to the first row we'll be showing
-    buffer += 3 * width * -canvas_offset_y;
-    image_display_h += canvas_offset_y;
-    if (image_display_h <= 0) return false;  // Done. outside canvas.
-    canvas_offset_y = 0;
-  }
-  const int w = std::min(c->width(), canvas_offset_x + image_display_w);
-  const int h = std::min(c->height(), canvas_offset_y + image_display_h);
-
-  // Bytes to skip for wider than canvas image at the end of a row
-  const size_t skip_end_row = (canvas_offset_x + image_display_w > w)
-    ? (canvas_offset_x + image_display_w - w) * 3
-    : 0;
-
-  // Let's make this a combined skip per row and adjust where we start.
-  const size_t next_row_skip = skip_start_row + skip_end_row;
-  buffer += skip_start_row;
-
-  if (is_bgr) {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[2], buffer[1], buffer[0]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
-    }
-  } else {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[0], buffer[1], buffer[2]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
-    }
-  }
+  // The canvas clips the rest, possibly writing whole rows at once.
+  c->SetPixelBuffer(canvas_offset_x, canvas_offset_y, width, height,
+                    buffer, 3, 3 * width, is_bgr);
   return true;
 }
 
@@ -83,6 +47,14 @@ int DrawText(Canvas *c, const Font &font,
   return DrawText(c, font, x, y, color, NULL, utf8_text);
 }
 
+// Advance of a character as DrawGlyph() would do it, including the
+// replacement character for unknown characters.
+static int GlyphAdvance(const Font &font, uint32_t cp) {
+  int width = font.CharacterWidth(cp);
+  if (width < 0) width = font.CharacterWidth(0xFFFD);
+  return std::max(width, 0);
+}
+
 int DrawText(Canvas *c, const Font &font,
              int x, int y, const Color &color, const Color *background_color,
              const char *utf8_text, int extra_spacing) {
@@ -105,6 +77,15 @@ int DrawText(Canvas *c, const Font &font,
   return DrawText(c, font, x, y, color, background_color, utf8_text, 0);
 }
 
+int TextWidth(const Font &font, const char *utf8_text, int extra_spacing) {
+  int width = 0;
+  while (*utf8_text) {
+    const uint32_t cp = utf8_next_codepoint(utf8_text);
+    width += GlyphAdvance(font, cp) + extra_spacing;
+  }
+  return width;
+}
+
 int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
                      const Color &color, const Color *background_color,
                      const char *utf8_text, int extra_spacing) {
@@ -117,56 +98,190 @@ int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
   return y - start_y;
 }
 
-void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
-  int x = radius, y = 0;
-  int radiusError = 1 - x;
-
-  while (y <= x) {
-    c->SetPixel(x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, -x + y0, color.r, color.g, color.b);
-    c->SetPixel(x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, -x + y0, color.r, color.g, color.b);
-    y++;
-    if (radiusError<0){
-      radiusError += 2 * y + 1;
-    } else {
-      x--;
-      radiusError+= 2 * (y - x + 1);
-    }
-  }
+static uint64_t NextKerningGeneration() {
+  static uint64_t generation = 0;
+  return __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
 }
 
-void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
-  int dy = y1 - y0, dx = x1 - x0, gradient, x, y, shift = 0x10;
+KerningTable::KerningTable() : generation_(NextKerningGeneration()) {}
 
-  if (abs(dx) > abs(dy)) {
-    // x variation is bigger than y variation
-    if (x1 < x0) {
-      std::swap(x0, x1);
-      std::swap(y0, y1);
-    }
-    gradient = (dy << shift) / dx ;
+void KerningTable::Set(uint32_t left, uint32_t right, int adjust) {
+  pairs_[((uint64_t)left << 32) | right] = adjust;
+  generation_ = NextKerningGeneration();
+}
+
+int KerningTable::Get(uint32_t left, uint32_t right) const {
+  std::map<uint64_t, int>::const_iterator found
+    = pairs_.find(((uint64_t)left << 32) | right);
+  return found == pairs_.end() ? 0 : found->second;
+}
+
+TextLayoutOptions::TextLayoutOptions()
+  : letter_spacing(0), line_spacing(0), wrap_width(0),
+    alignment(ALIGN_LEFT), max_lines(0), kerning(NULL) {}
+
+// Pixels character "cp" adds to the line after "previous" (0 at line start).
+static int CharacterPitch(const Font &font, const TextLayoutOptions &options,
+                          uint32_t previous, uint32_t cp) {
+  int pitch = GlyphAdvance(font, cp) + options.letter_spacing;
+  if (previous && options.kerning) pitch += options.kerning->Get(previous, cp);
+  return pitch;
+}
 
-    for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
-      c->SetPixel(x, y >> shift, color.r, color.g, color.b);
+TextLayout::TextLayout(const Font &font, const char *utf8_text,
+                       const TextLayoutOptions &options)
+  : font_(font), width_(0), height_(0), line_count_(0) {
+  // Decode once, split into lines at newlines.
+  std::vector<uint32_t> text;
+  std::vector<size_t> line_ends;
+  while (*utf8_text) {
+    const uint32_t cp = utf8_next_codepoint(utf8_text);
+    if (cp == '\r') continue;
+    if (cp == '\n') line_ends.push_back(text.size());
+    else text.push_back(cp);
+  }
+  line_ends.push_back(text.size());
+
+  // Break into lines that fit the wrap width: [begin, end) ranges in text.
+  std::vector<std::pair<size_t, size_t> > lines;
+  const int wrap = options.wrap_width;
+  size_t begin = 0;
+  for (size_t n = 0; n < line_ends.size(); ++n) {
+    const size_t paragraph_end = line_ends[n];
+    bool wrapped = false;
+    do {
+      if (wrapped) {
+        // Don't start a wrapped line with blanks.
+        while (begin < paragraph_end && text[begin] == ' ') ++begin;
+      }
+      size_t end = paragraph_end;
+      if (wrap > 0) {
+        int x = 0;
+        size_t last_blank = begin;   // begin: no blank seen.
+        for (size_t i = begin; i < paragraph_end; ++i) {
+          const uint32_t cp = text[i];
+          const int kern = (i > begin && options.kerning)
+            ? options.kerning->Get(text[i-1], cp) : 0;
+          if (cp != ' ' && i > begin
+              && x + kern + GlyphAdvance(font, cp) > wrap) {
+            end = (last_blank > begin) ? last_blank : i;
+            break;
+          }
+          if (cp == ' ') last_blank = i;
+          x += CharacterPitch(font, options, i > begin ? text[i-1] : 0, cp);
+        }
+      }
+      lines.push_back(std::make_pair(begin, end));
+      wrapped = (end < paragraph_end);
+      begin = end;
+    } while (wrapped);
+    begin = paragraph_end;
+  }
+  if (options.max_lines > 0 && (int)lines.size() > options.max_lines)
+    lines.resize(options.max_lines);
+
+  // Place glyphs.
+  std::vector<int> line_width(lines.size());
+  std::vector<size_t> first_glyph(lines.size() + 1);
+  for (size_t line = 0; line < lines.size(); ++line) {
+    first_glyph[line] = glyphs_.size();
+    int x = 0;
+    for (size_t i = lines[line].first; i < lines[line].second; ++i) {
+      if (i > lines[line].first && options.kerning)
+        x += options.kerning->Get(text[i-1], text[i]);
+      const PlacedGlyph g = { text[i], x, 0 };
+      glyphs_.push_back(g);
+      if (text[i] != ' ')
+        line_width[line] = x + GlyphAdvance(font, text[i]);
+      x += GlyphAdvance(font, text[i]) + options.letter_spacing;
     }
-  } else if (dy != 0) {
-    // y variation is bigger than x variation
-    if (y1 < y0) {
-      std::swap(x0, x1);
-      std::swap(y0, y1);
+  }
+  first_glyph[lines.size()] = glyphs_.size();
+
+  line_count_ = lines.size();
+  width_ = (wrap > 0) ? wrap
+    : *std::max_element(line_width.begin(), line_width.end());
+  const int line_height = font.height() + options.line_spacing;
+  height_ = line_count_ * line_height - options.line_spacing;
+
+  for (int line = 0; line < line_count_; ++line) {
+    int offset = 0;
+    switch (options.alignment) {
+    case TextLayoutOptions::ALIGN_LEFT: break;
+    case TextLayoutOptions::ALIGN_CENTER:
+      offset = (width_ - line_width[line]) / 2; break;
+    case TextLayoutOptions::ALIGN_RIGHT:
+      offset = width_ - line_width[line]; break;
     }
-    gradient = (dx << shift) / dy;
-    for (y = y0 , x = 0x8000 + (x0 << shift); y <= y1; ++y, x += gradient) {
-      c->SetPixel(x >> shift, y, color.r, color.g, color.b);
+    const int baseline = line * line_height + font.baseline();
+    for (size_t i = first_glyph[line]; i < first_glyph[line+1]; ++i) {
+      glyphs_[i].x += offset;
+      glyphs_[i].baseline = baseline;
     }
-  } else {
-    c->SetPixel(x0, y0, color.r, color.g, color.b);
   }
 }
 
+void TextLayout::Draw(Canvas *c, int x, int y, const Color &color,
+                      const Color *background_color) const {
+  const int canvas_height = c->height();
+  for (size_t i = 0; i < glyphs_.size(); ++i) {
+    const PlacedGlyph &g = glyphs_[i];
+    const int baseline = y + g.baseline;
+    if (baseline - font_.baseline() >= canvas_height)
+      break;  // This and all following lines are below the canvas.
+    if (baseline - font_.baseline() + font_.height() < 0)
+      continue;
+    font_.DrawGlyph(c, x + g.x, baseline, color, background_color,
+                    g.codepoint);
+  }
+}
+
+TextLayoutCache::TextLayoutCache(int max_entries)
+  : max_entries_(std::max(max_entries, 1)) {}
+
+TextLayoutCache::~TextLayoutCache() {
+  Clear();
+}
+
+void TextLayoutCache::Clear() {
+  for (EntryList::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+    delete it->layout;
+  }
+  entries_.clear();
+  layouts_.clear();
+}
+
+const TextLayout &TextLayoutCache::Get(const Font &font, const char *utf8_text,
+                                       const TextLayoutOptions &options) {
+  char prefix[128];
+  snprintf(prefix, sizeof(prefix), "%" PRIu64 "/%d/%d/%d/%d/%d/%" PRIu64 ":",
+           font.generation(), options.letter_spacing, options.line_spacing,
+           options.wrap_width, (int)options.alignment, options.max_lines,
+           options.kerning ? options.kerning->generation() : 0);
+  const std::string key = std::string(prefix) + utf8_text;
+  LayoutMap::iterator found = layouts_.find(key);
+  if (found != layouts_.end()) {
+    entries_.splice(entries_.begin(), entries_, found->second);
+    return *found->second->layout;
+  }
+
+  if (layouts_.size() >= max_entries_) {
+    delete entries_.back().layout;
+    layouts_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+  const Entry entry = { key, new TextLayout(font, utf8_text, options) };
+  entries_.push_front(entry);
+  layouts_[key] = entries_.begin();
+  return *entry.layout;
+}
+
+void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
+  DrawContext(c).DrawCircle(x0, y0, radius, color);
+}
+
+void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
+  DrawContext(c).DrawLine(x0, y0, x1, y1, color);
+}
+
 }//namespace
@@ -21,6 +21,7 @@
 
 #include "led-matrix.h"
 #include "graphics.h"
+#include "frame-server.h"
 
 // Make sure C++ is in sync with C
 static_assert(sizeof(rgb_matrix::RGBMatrix::Options) == sizeof(RGBLedMatrixOptions), "C and C++ out of sync");
@@ -30,6 +31,7 @@ static_assert(sizeof(rgb_matrix::RuntimeOptions) == sizeof(RGBLedRuntimeOptions)
 struct RGBLedMatrix {};
 struct LedCanvas {};
 struct LedFont {};
+struct LedFrameProducer {};
 
 
 static rgb_matrix::RGBMatrix *to_matrix(struct RGBLedMatrix *matrix) {
@@ -234,6 +236,36 @@ void led_canvas_set_pixels(struct LedCanvas *canvas, int x, int y,
   to_canvas(canvas)->SetPixels(x, y, width, height, to_color(colors));
 }
 
+void led_canvas_set_pixel_buffer(struct LedCanvas *canvas, int x, int y,
+                                 int width, int height,
+                                 const uint8_t *pixels, int stride,
+                                 enum LedPixelFormat format) {
+  int pixel_step = 4;
+  bool is_bgr = false;
+  switch (format) {
+  case LED_PIXEL_FORMAT_RGB:  pixel_step = 3; break;
+  case LED_PIXEL_FORMAT_BGR:  pixel_step = 3; is_bgr = true; break;
+  case LED_PIXEL_FORMAT_RGBA: break;
+  case LED_PIXEL_FORMAT_BGRA: is_bgr = true; break;
+  case LED_PIXEL_FORMAT_ARGB: pixels += 1; break;  // Skip the alpha byte.
+  case LED_PIXEL_FORMAT_ABGR: pixels += 1; is_bgr = true; break;
+  default: return;
+  }
+  if (stride == 0) stride = pixel_step * width;
+  to_canvas(canvas)->SetPixelBuffer(x, y, width, height, pixels,
+                                    pixel_step, stride, is_bgr);
+}
+
+void led_canvas_copy(struct LedCanvas *dst, const struct LedCanvas *src) {
+  to_canvas(dst)->CopyFrom(*to_canvas((struct LedCanvas*)src));
+}
+
+void led_canvas_copy_region(struct LedCanvas *dst, const struct LedCanvas *src,
+                            int x, int y, int width, int height) {
+  to_canvas(dst)->CopyRegionFrom(*to_canvas((struct LedCanvas*)src),
+                                 x, y, width, height);
+}
+
 void led_canvas_clear(struct LedCanvas *canvas) {
   to_canvas(canvas)->Clear();
 }
@@ -323,3 +355,33 @@ void draw_line(struct LedCanvas *c, int x0, int y0, int x1, int y1, uint8_t r, u
   const rgb_matrix::Color col = rgb_matrix::Color(r, g, b);
   DrawLine(to_canvas(c), x0, y0, x1, y1, col);
 }
+
+static rgb_matrix::FrameProducer *to_producer(struct LedFrameProducer *p) {
+  return reinterpret_cast<rgb_matrix::FrameProducer*>(p);
+}
+
+struct LedFrameProducer *frame_producer_connect(const char *name,
+                                               int channel) {
+  return reinterpret_cast<struct LedFrameProducer*>(
+    rgb_matrix::FrameProducer::Connect(name, channel));
+}
+
+void frame_producer_delete(struct LedFrameProducer *producer) {
+  delete to_producer(producer);
+}
+
+void frame_producer_get_size(const struct LedFrameProducer *producer,
+                             int *width, int *height) {
+  const rgb_matrix::FrameProducer *p
+    = reinterpret_cast<const rgb_matrix::FrameProducer*>(producer);
+  if (width != NULL) *width = p->width();
+  if (height != NULL) *height = p->height();
+}
+
+uint8_t *frame_producer_frame(struct LedFrameProducer *producer) {
+  return to_producer(producer)->frame();
+}
+
+void frame_producer_submit(struct LedFrameProducer *producer) {
+  to_producer(producer)->Submit();
+}
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
@@ -73,7 +74,11 @@ public:
   bool StartRefresh();
 
   FrameCanvas *CreateFrameCanvas();
+  FrameCanvas *CreateScrollingFrameCanvas(int virtual_width);
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *ScheduleSwap(FrameCanvas *other, unsigned framerate_fraction);
+  int vsync_fd() const;
+  int input_fd() const;
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
   bool SetPWMBits(uint8_t value);
@@ -127,9 +132,11 @@ public:
       allow_busy_waiting_(allow_busy_waiting),
       running_(true),
       current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+      requested_frame_multiple_(1), notify_swap_(false) {
     pthread_cond_init(&frame_done_, NULL);
     pthread_cond_init(&input_change_, NULL);
+    vsync_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    input_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     switch (pwm_dither_bits) {
     case 0:
       start_bit_[0] = 0; start_bit_[1] = 0;
@@ -146,6 +153,11 @@ public:
     }
   }
 
+  virtual ~UpdateThread() {
+    if (vsync_fd_ >= 0) close(vsync_fd_);
+    if (input_fd_ >= 0) close(input_fd_);
+  }
+
   void Stop() {
     MutexLock l(&running_mutex_);
     running_ = false;
@@ -182,6 +194,10 @@ public:
             current_frame_ = next_frame_;
             next_frame_ = NULL;
           }
+          if (notify_swap_) {
+            notify_swap_ = false;
+            Notify(vsync_fd_);
+          }
           pthread_cond_signal(&frame_done_);
         }
       }
@@ -193,6 +209,7 @@ public:
         MutexLock l(&input_sync_);
         gpio_inputs_ = inputs;
         pthread_cond_signal(&input_change_);
+        Notify(input_fd_);
       }
 
       ++frame_count;
@@ -235,6 +252,18 @@ public:
     return previous;
   }
 
+  FrameCanvas *ScheduleSwap(FrameCanvas *other, unsigned frame_fraction) {
+    MutexLock l(&frame_sync_);
+    FrameCanvas *previous = current_frame_;
+    next_frame_ = other;
+    requested_frame_multiple_ = frame_fraction;
+    notify_swap_ = true;
+    return previous;
+  }
+
+  int vsync_fd() const { return vsync_fd_; }
+  int input_fd() const { return input_fd_; }
+
   gpio_bits_t AwaitInputChange(int timeout_ms) {
     MutexLock l(&input_sync_);
     input_sync_.WaitOn(&input_change_, timeout_ms);
@@ -247,6 +276,14 @@ private:
     return running_;
   }
 
+  // Make an eventfd readable.
+  static void Notify(int fd) {
+    const uint64_t one = 1;
+    if (fd >= 0 && write(fd, &one, sizeof(one)) < 0) {
+      // Counter full; the reader has plenty to read already.
+    }
+  }
+
   GPIO *const io_;
   const bool show_refresh_;
   const uint32_t target_frame_usec_;
@@ -265,6 +302,10 @@ private:
   FrameCanvas *current_frame_;
   FrameCanvas *next_frame_;
   unsigned requested_frame_multiple_;
+  bool notify_swap_;   // Notify vsync_fd_ with the next swap.
+
+  int vsync_fd_;
+  int input_fd_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -531,6 +572,33 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   return result;
 }
 
+FrameCanvas *RGBMatrix::Impl::CreateScrollingFrameCanvas(int virtual_width) {
+  const int columns = params_.cols * params_.chain_length;
+  if (virtual_width < columns)
+    return NULL;
+
+  // We can only widen rows if the visible pixels map straight to panel rows.
+  if (shared_pixel_mapper_->width() != columns
+      || shared_pixel_mapper_->height() != params_.rows * params_.parallel)
+    return NULL;
+  for (int y = 0; y < shared_pixel_mapper_->height(); ++y) {
+    if (!active_->framebuffer()->IsLinearRow(y))
+      return NULL;
+  }
+
+  FrameCanvas *result =
+    new FrameCanvas(new Framebuffer(params_.rows, columns,
+                                    params_.parallel,
+                                    params_.scan_mode,
+                                    params_.inverse_colors,
+                                    shared_pixel_mapper_, virtual_width));
+  result->framebuffer()->SetPWMBits(params_.pwm_bits);
+  result->framebuffer()->set_luminance_correct(do_luminance_correct_);
+  result->framebuffer()->SetBrightness(params_.brightness);
+  created_frames_.push_back(result);
+  return result;
+}
+
 FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
                                           unsigned frame_fraction) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
@@ -540,6 +608,23 @@ FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
   return previous;
 }
 
+FrameCanvas *RGBMatrix::Impl::ScheduleSwap(FrameCanvas *other,
+                                           unsigned frame_fraction) {
+  if (frame_fraction == 0) frame_fraction = 1; // correct user error.
+  if (!updater_) return NULL;
+  FrameCanvas *const previous = updater_->ScheduleSwap(other, frame_fraction);
+  if (other) active_ = other;
+  return previous;
+}
+
+int RGBMatrix::Impl::vsync_fd() const {
+  return updater_ ? updater_->vsync_fd() : -1;
+}
+
+int RGBMatrix::Impl::input_fd() const {
+  return updater_ ? updater_->input_fd() : -1;
+}
+
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
@@ -745,10 +830,19 @@ RGBMatrix *RGBMatrix::CreateFromFlags(int *argc, char ***argv,
 FrameCanvas *RGBMatrix::CreateFrameCanvas() {
   return impl_->CreateFrameCanvas();
 }
+FrameCanvas *RGBMatrix::CreateScrollingFrameCanvas(int virtual_width) {
+  return impl_->CreateScrollingFrameCanvas(virtual_width);
+}
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
   return impl_->SwapOnVSync(other, framerate_fraction);
 }
+FrameCanvas *RGBMatrix::ScheduleSwap(FrameCanvas *other,
+                                      unsigned framerate_fraction) {
+  return impl_->ScheduleSwap(other, framerate_fraction);
+}
+int RGBMatrix::vsync_fd() const { return impl_->vsync_fd(); }
+int RGBMatrix::input_fd() const { return impl_->input_fd(); }
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   return impl_->ApplyPixelMapper(mapper);
 }
@@ -794,6 +888,13 @@ void RGBMatrix::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue)
   impl_->active_->SetPixel(x, y, red, green, blue);
 }
 
+void RGBMatrix::SetPixelBuffer(int x, int y, int width, int height,
+                               const uint8_t *pixels, int pixel_step,
+                               int stride, bool is_bgr) {
+  impl_->active_->SetPixelBuffer(x, y, width, height,
+                                 pixels, pixel_step, stride, is_bgr);
+}
+
 void RGBMatrix::Clear() {
   impl_->active_->Clear();
 }
@@ -802,6 +903,11 @@ void RGBMatrix::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   impl_->active_->Fill(red, green, blue);
 }
 
+void RGBMatrix::SubFill(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+  impl_->active_->SubFill(x, y, width, height, red, green, blue);
+}
+
 // FrameCanvas implementation of Canvas
 FrameCanvas::~FrameCanvas() { delete frame_; }
 int FrameCanvas::width() const { return frame_->width(); }
@@ -814,6 +920,12 @@ void FrameCanvas::SetPixels(int x, int y, int width, int height,
                          Color *colors) {
   frame_->SetPixels(x, y, width, height, colors);
 }
+void FrameCanvas::SetPixelBuffer(int x, int y, int width, int height,
+                                 const uint8_t *pixels, int pixel_step,
+                                 int stride, bool is_bgr) {
+  frame_->SetPixelBuffer(x, y, width, height,
+                         pixels, pixel_step, stride, is_bgr);
+}
 void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
@@ -840,4 +952,15 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+void FrameCanvas::CopyRegionFrom(const FrameCanvas &other,
+                                 int x, int y, int width, int height) {
+  frame_->CopyRegionFrom(other.frame_, x, y, width, height);
+}
+
+void FrameCanvas::SetScrollOffset(int offset) {
+  frame_->SetScrollOffset(offset);
+}
+int FrameCanvas::scroll_offset() const {
+  return frame_->scroll_offset();
+}
 }  // end namespace rgb_matrix
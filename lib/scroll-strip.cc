@@ -0,0 +1,131 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+
+#include "scroll-strip.h"
+#include "led-matrix.h"
+
+#include <algorithm>
+
+#include "framebuffer-internal.h"
+#include "gpio-bits.h"
+
+namespace rgb_matrix {
+
+// The strip content in the bitplane representation of the FrameCanvas it
+// was last shown on, together with the settings that went into it.
+struct ScrollStrip::Encoding {
+  Encoding() : valid(false), mapper(NULL), pwm_bits(0), brightness(0),
+               luminance_correct(false) {}
+
+  bool valid;
+  const internal::PixelDesignatorMap *mapper;
+  uint8_t pwm_bits;
+  uint8_t brightness;
+  bool luminance_correct;
+
+  // Rows that can be copied as pre-encoded words. Others are
+  // written pixel by pixel.
+  std::vector<bool> linear_row;
+
+  // For each row, pwm_bits planes of "width" words.
+  std::vector<gpio_bits_t> rows;
+};
+
+ScrollStrip::ScrollStrip(int width, int height)
+  : width_(std::max(width, 1)), height_(std::max(height, 0)),
+    pixels_(width_ * height_), encoding_(new Encoding()) {
+}
+
+ScrollStrip::~ScrollStrip() {
+  delete encoding_;
+}
+
+void ScrollStrip::SetPixel(int x, int y,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  pixels_[y * width_ + x].setColor(red, green, blue);
+  encoding_->valid = false;
+}
+
+void ScrollStrip::Clear() {
+  Fill(0, 0, 0);
+}
+
+void ScrollStrip::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  std::fill(pixels_.begin(), pixels_.end(), Color(red, green, blue));
+  encoding_->valid = false;
+}
+
+void ScrollStrip::SubFill(int x, int y, int width, int height,
+                          uint8_t red, uint8_t green, uint8_t blue) {
+  const int x_start = std::max(x, 0);
+  const int x_end = std::min(x + width, width_);
+  const int y_end = std::min(y + height, height_);
+  if (x_start >= x_end) return;
+  const Color color(red, green, blue);
+  for (int row = std::max(y, 0); row < y_end; ++row) {
+    std::fill(pixels_.begin() + row * width_ + x_start,
+              pixels_.begin() + row * width_ + x_end, color);
+  }
+  encoding_->valid = false;
+}
+
+void ScrollStrip::Encode(FrameCanvas *canvas) {
+  internal::Framebuffer *fb = canvas->framebuffer();
+  Encoding *const e = encoding_;
+  e->mapper = fb->pixel_designator_map();
+  e->pwm_bits = fb->pwmbits();
+  e->brightness = fb->brightness();
+  e->luminance_correct = fb->luminance_correct();
+
+  const int rows = std::min(height_, canvas->height());
+  const size_t row_words = (size_t)e->pwm_bits * width_;
+  e->linear_row.assign(rows, false);
+  e->rows.resize(rows * row_words);
+  for (int y = 0; y < rows; ++y) {
+    if (!fb->IsLinearRow(y))
+      continue;
+    e->linear_row[y] = true;
+    fb->EncodeRow(y, &pixels_[y * width_], width_, &e->rows[y * row_words]);
+  }
+  e->valid = true;
+}
+
+void ScrollStrip::Blit(FrameCanvas *canvas, int offset) {
+  internal::Framebuffer *fb = canvas->framebuffer();
+  Encoding *const e = encoding_;
+  if (!e->valid || e->mapper != fb->pixel_designator_map()
+      || e->pwm_bits != fb->pwmbits() || e->brightness != fb->brightness()
+      || e->luminance_correct != fb->luminance_correct()
+      || (int)e->linear_row.size() != std::min(height_, canvas->height())) {
+    Encode(canvas);
+  }
+
+  offset %= width_;
+  if (offset < 0) offset += width_;
+  const int canvas_width = canvas->width();
+  const int rows = e->linear_row.size();
+  const size_t row_words = (size_t)e->pwm_bits * width_;
+  for (int y = 0; y < rows; ++y) {
+    if (e->linear_row[y]) {
+      // Copy pre-encoded columns; in segments where we wrap around.
+      const gpio_bits_t *encoded = &e->rows[y * row_words];
+      int column = offset;
+      for (int x = 0; x < canvas_width; /**/) {
+        const int count = std::min(canvas_width - x, width_ - column);
+        fb->CopyEncodedRow(y, x, count, encoded + column, width_);
+        x += count;
+        column = 0;
+      }
+    } else {
+      const Color *row = &pixels_[y * width_];
+      int column = offset;
+      for (int x = 0; x < canvas_width; ++x) {
+        const Color &c = row[column];
+        canvas->SetPixel(x, y, c.r, c.g, c.b);
+        if (++column == width_) column = 0;
+      }
+    }
+  }
+}
+
+}  // namespace rgb_matrix
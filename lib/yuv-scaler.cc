@@ -0,0 +1,136 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "yuv-scaler.h"
+#include "led-matrix.h"
+
+#include <algorithm>
+
+namespace rgb_matrix {
+
+static inline uint8_t Clamp(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+YUV420Scaler::YUV420Scaler(int src_width, int src_height,
+                           int dst_width, int dst_height,
+                           ColorSpace color_space, bool full_range)
+  : src_width_(std::max(src_width, 1)), src_height_(std::max(src_height, 1)),
+    dst_width_(std::max(dst_width, 0)), dst_height_(std::max(dst_height, 0)),
+    full_range_(full_range) {
+  // Chroma to RGB factors, times 256. Video range chroma only spans
+  // 16..240, so needs to be stretched more.
+  if (color_space == BT709) {
+    red_v_ = full_range ? 403 : 459;
+    green_u_ = full_range ? 48 : 55;
+    green_v_ = full_range ? 120 : 136;
+    blue_u_ = full_range ? 475 : 541;
+  } else {
+    red_v_ = full_range ? 359 : 409;
+    green_u_ = full_range ? 88 : 100;
+    green_v_ = full_range ? 183 : 208;
+    blue_u_ = full_range ? 454 : 516;
+  }
+
+  ComputeSpans(src_width_, dst_width_, &columns_);
+  ComputeSpans(src_height_, dst_height_, &rows_);
+  // The chroma planes cover the same area with half the resolution.
+  chroma_columns_ = columns_;
+  for (size_t i = 0; i < chroma_columns_.size(); ++i) {
+    Span &s = chroma_columns_[i];
+    s.start /= 2;
+    s.end = std::max(s.start + 1, (s.end + 1) / 2);
+  }
+  chroma_rows_ = rows_;
+  for (size_t i = 0; i < chroma_rows_.size(); ++i) {
+    Span &s = chroma_rows_[i];
+    s.start /= 2;
+    s.end = std::max(s.start + 1, (s.end + 1) / 2);
+  }
+
+  y_sums_.resize(src_width_);
+  u_sums_.resize((src_width_ + 1) / 2);
+  v_sums_.resize((src_width_ + 1) / 2);
+  output_row_.resize(dst_width_);
+}
+
+void YUV420Scaler::ComputeSpans(int src_size, int dst_size,
+                                std::vector<Span> *spans) {
+  spans->resize(dst_size);
+  for (int i = 0; i < dst_size; ++i) {
+    Span &s = (*spans)[i];
+    s.start = (int64_t)i * src_size / dst_size;
+    // When enlarging, spans would be empty; take the nearest pixel then.
+    s.end = std::max(s.start + 1, (int)((int64_t)(i + 1) * src_size / dst_size));
+  }
+}
+
+// Add up the rows of "plane" in the span, for each of the "width" columns.
+// Independent columns in the inner loop, so this vectorizes well.
+void YUV420Scaler::SumRows(const uint8_t *plane, int stride, int width,
+                           const Span &rows, uint32_t *sums) {
+  std::fill(sums, sums + width, 0);
+  for (int row = rows.start; row < rows.end; ++row) {
+    const uint8_t *pixels = plane + row * stride;
+    for (int x = 0; x < width; ++x) {
+      sums[x] += pixels[x];
+    }
+  }
+}
+
+void YUV420Scaler::Scale(const YUV420Image &image, FrameCanvas *canvas,
+                         int x, int y) {
+  if (image.width != src_width_ || image.height != src_height_) return;
+  const int chroma_width = (src_width_ + 1) / 2;
+  const int luma_offset = full_range_ ? 0 : 16;
+  const int luma_factor = full_range_ ? 256 : 298;
+
+  for (int row = 0; row < dst_height_; ++row) {
+    const Span &rows = rows_[row];
+    const Span &chroma_rows = chroma_rows_[row];
+    SumRows(image.y, image.y_stride, src_width_, rows, y_sums_.data());
+    SumRows(image.u, image.u_stride, chroma_width, chroma_rows, u_sums_.data());
+    SumRows(image.v, image.v_stride, chroma_width, chroma_rows, v_sums_.data());
+    const int row_count = rows.end - rows.start;
+    const int chroma_row_count = chroma_rows.end - chroma_rows.start;
+
+    for (int col = 0; col < dst_width_; ++col) {
+      const Span &cols = columns_[col];
+      const Span &chroma_cols = chroma_columns_[col];
+      uint32_t y_sum = 0, u_sum = 0, v_sum = 0;
+      for (int i = cols.start; i < cols.end; ++i) {
+        y_sum += y_sums_[i];
+      }
+      for (int i = chroma_cols.start; i < chroma_cols.end; ++i) {
+        u_sum += u_sums_[i];
+        v_sum += v_sums_[i];
+      }
+      const uint32_t count = (cols.end - cols.start) * row_count;
+      const uint32_t chroma_count
+        = (chroma_cols.end - chroma_cols.start) * chroma_row_count;
+      const int luma = (y_sum + count / 2) / count;
+      const int u = (int)((u_sum + chroma_count / 2) / chroma_count) - 128;
+      const int v = (int)((v_sum + chroma_count / 2) / chroma_count) - 128;
+
+      const int scaled_luma = luma_factor * (luma - luma_offset) + 128;
+      Color &out = output_row_[col];
+      out.r = Clamp((scaled_luma + red_v_ * v) >> 8);
+      out.g = Clamp((scaled_luma - green_u_ * u - green_v_ * v) >> 8);
+      out.b = Clamp((scaled_luma + blue_u_ * u) >> 8);
+    }
+    canvas->SetPixels(x, y + row, dst_width_, 1, output_row_.data());
+  }
+}
+
+}  // namespace rgb_matrix
@@ -0,0 +1,155 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "zone-manager.h"
+#include "led-matrix.h"
+
+#include <algorithm>
+
+namespace rgb_matrix {
+
+Zone::Zone(ZoneManager *manager, int x, int y, int width, int height)
+  : manager_(manager), x_(x), y_(y),
+    width_(std::max(width, 0)), height_(std::max(height, 0)),
+    drawing_(width_ * height_), committed_(width_ * height_),
+    committed_new_(false), shown_(width_ * height_) {
+}
+
+bool Zone::Overlaps(const Zone &other) const {
+  return x_ < other.x_ + other.width_ && other.x_ < x_ + width_
+    && y_ < other.y_ + other.height_ && other.y_ < y_ + height_;
+}
+
+void Zone::Commit() {
+  MutexLock l(&manager_->mutex_);
+  std::copy(drawing_.begin(), drawing_.end(), committed_.begin());
+  committed_new_ = true;
+  manager_->have_commits_ = true;
+  pthread_cond_signal(&manager_->committed_);
+}
+
+void Zone::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  drawing_[y * width_ + x] = Color(red, green, blue);
+}
+
+void Zone::Clear() {
+  Fill(0, 0, 0);
+}
+
+void Zone::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  std::fill(drawing_.begin(), drawing_.end(), Color(red, green, blue));
+}
+
+void Zone::SubFill(int x, int y, int width, int height,
+                   uint8_t red, uint8_t green, uint8_t blue) {
+  const int x_start = std::max(0, x);
+  const int x_end = std::min(width_, x + width);
+  const int y_start = std::max(0, y);
+  const int y_end = std::min(height_, y + height);
+  if (x_start >= x_end) return;
+  const Color color(red, green, blue);
+  for (int row = y_start; row < y_end; ++row) {
+    std::fill(drawing_.begin() + row * width_ + x_start,
+              drawing_.begin() + row * width_ + x_end, color);
+  }
+}
+
+ZoneManager::ZoneManager(RGBMatrix *matrix)
+  : matrix_(matrix), offscreen_(matrix->CreateFrameCanvas()),
+    onscreen_(NULL), have_commits_(false) {
+  pthread_cond_init(&committed_, NULL);
+}
+
+ZoneManager::~ZoneManager() {
+  for (size_t i = 0; i < zones_.size(); ++i) {
+    delete zones_[i];
+  }
+  pthread_cond_destroy(&committed_);
+}
+
+Zone *ZoneManager::AddZone(int x, int y, int width, int height) {
+  Zone *zone = new Zone(this, x, y, width, height);
+  MutexLock l(&mutex_);
+  zones_.push_back(zone);
+  stale_.push_back(false);
+  have_commits_ = true;   // Show it.
+  zone->committed_new_ = true;
+  return zone;
+}
+
+bool ZoneManager::WaitForCommits(long timeout_ms) {
+  MutexLock l(&mutex_);
+  if (!have_commits_) mutex_.WaitOn(&committed_, timeout_ms);
+  return have_commits_;
+}
+
+bool ZoneManager::Update(unsigned framerate_fraction) {
+  std::vector<bool> changed(zones_.size(), false);
+  {
+    MutexLock l(&mutex_);
+    if (!have_commits_) return false;
+    have_commits_ = false;
+    for (size_t i = 0; i < zones_.size(); ++i) {
+      Zone *const zone = zones_[i];
+      if (!zone->committed_new_) continue;
+      zone->shown_.swap(zone->committed_);
+      zone->committed_new_ = false;
+      changed[i] = true;
+    }
+  }
+
+  // Bring the zones that changed in the previous frame up to date by
+  // copying what is shown right now...
+  for (size_t i = 0; i < zones_.size(); ++i) {
+    if (!stale_[i] || changed[i]) continue;
+    const Zone *const zone = zones_[i];
+    offscreen_->CopyRegionFrom(*onscreen_, zone->x_, zone->y_,
+                               zone->width_, zone->height_);
+  }
+
+  // ... then write the new content. Zones on top of a written zone need
+  // to be written again.
+  for (size_t i = 0; i < zones_.size(); ++i) {
+    Zone *const zone = zones_[i];
+    bool write = changed[i];
+    for (size_t below = 0; !write && below < i; ++below) {
+      write = stale_[below] && zones_[below]->Overlaps(*zone);
+    }
+    stale_[i] = write;
+    if (!write) continue;
+    offscreen_->SetPixels(zone->x_, zone->y_, zone->width_, zone->height_,
+                          zone->shown_.data());
+  }
+
+  FrameCanvas *const previous
+    = matrix_->SwapOnVSync(offscreen_, framerate_fraction);
+  if (previous == NULL) {
+    // No hardware to show it; we just keep drawing into the same canvas.
+    std::fill(stale_.begin(), stale_.end(), false);
+    return true;
+  }
+  const bool first_swap = (onscreen_ == NULL);
+  onscreen_ = offscreen_;
+  offscreen_ = previous;
+  if (first_swap) {
+    // We don't know what is in the canvas shown before, so start over
+    // with a full copy once.
+    offscreen_->CopyFrom(*onscreen_);
+    std::fill(stale_.begin(), stale_.end(), false);
+  }
+  return true;
+}
+
+}  // namespace rgb_matrix
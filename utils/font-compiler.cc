@@ -0,0 +1,48 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Convert a BDF font into the binary font format that can be memory-mapped
+// by Font::LoadFont() without any parsing.
+
+#include "graphics.h"
+
+#include <stdio.h>
+
+using namespace rgb_matrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s <input-font> <output-file>\n", progname);
+  fprintf(stderr, "Converts a *.bdf font into the binary font format, "
+          "which loads\nin constant time. Use the output file like any "
+          "other font file.\n"
+          "Note: the binary format is in native byte-order, so create it "
+          "on the\nsame architecture it is used.\n");
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3)
+    return usage(argv[0]);
+
+  Font font;
+  if (!font.LoadFont(argv[1])) {
+    fprintf(stderr, "Couldn't load font '%s'\n", argv[1]);
+    return 1;
+  }
+  if (!font.WriteBinaryFont(argv[2])) {
+    fprintf(stderr, "Couldn't write '%s'\n", argv[2]);
+    return 1;
+  }
+  return 0;
+}
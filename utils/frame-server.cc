@@ -0,0 +1,148 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Daemon that owns the matrix and shows frames other processes submit
+// through shared memory (see include/frame-server.h).
+
+#include "led-matrix.h"
+#include "compositor.h"
+#include "frame-server.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Shows frames submitted by other processes through "
+          "shared memory.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr,
+          "\t-n <name>         : Name of the shared memory. "
+          "Default: /rgbmatrix\n"
+          "\t-c <channels>     : Number of channels, i.e. producers that "
+          "can show\n"
+          "\t                    frames at the same time. Default: 4\n"
+          "\t-v                : Verbose: report producers coming and "
+          "going.\n"
+          );
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  const char *name = "/rgbmatrix";
+  int channels = 4;
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:v")) != -1) {
+    switch (opt) {
+    case 'n': name = optarg; break;
+    case 'c': channels = atoi(optarg); break;
+    case 'v': verbose = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (channels < 1) {
+    fprintf(stderr, "Need at least one channel.\n");
+    return usage(argv[0]);
+  }
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options, runtime_opt);
+  if (matrix == NULL)
+    return 1;
+
+  FrameServer *server = FrameServer::Create(name, matrix->width(),
+                                            matrix->height(), channels);
+  if (server == NULL) {
+    delete matrix;
+    return 1;
+  }
+
+  // One full-size layer per channel, higher channels on top.
+  Compositor compositor(matrix->width(), matrix->height());
+  std::vector<Layer*> layers;
+  for (int c = 0; c < channels; ++c) {
+    Layer *layer = compositor.AddLayer(matrix->width(), matrix->height());
+    layer->SetVisible(false);
+    layers.push_back(layer);
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  if (verbose) {
+    fprintf(stderr, "Serving %dx%d frames on %s with %d channels.\n",
+            server->width(), server->height(), name, channels);
+  }
+  printf("CTRL-C for exit.\n");
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  while (!interrupt_received) {
+    server->WaitForFrames(100);
+
+    bool changed = false;
+    for (int c = 0; c < channels; ++c) {
+      Layer *const layer = layers[c];
+      // Take frames before looking at the owner, so that the last frame of
+      // a producer that submitted and exited right away is still shown.
+      const uint8_t *rgba;
+      if (server->TakeFrame(c, &rgba)) {
+        layer->SetImage(0, 0, rgba, server->width(), server->height(),
+                        4 * server->width());
+        if (!layer->visible()) {
+          if (verbose) fprintf(stderr, "Channel %d active.\n", c);
+          layer->SetVisible(true);
+        }
+        changed = true;
+      } else if (!server->IsActive(c) && layer->visible()) {
+        if (verbose) fprintf(stderr, "Channel %d released.\n", c);
+        layer->SetVisible(false);
+        changed = true;
+      }
+    }
+
+    if (changed) {
+      compositor.Compose(offscreen);
+      offscreen = matrix->SwapOnVSync(offscreen);
+    }
+  }
+
+  delete server;
+  delete matrix;   // Make sure to delete it in the end to switch off LEDs.
+
+  printf("\n");
+  return 0;
+}
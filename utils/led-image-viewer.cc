@@ -22,6 +22,7 @@
 #include "led-matrix.h"
 #include "pixel-mapper.h"
 #include "content-streamer.h"
+#include "thread.h"
 
 #include <fcntl.h>
 #include <math.h>
@@ -35,6 +36,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
@@ -64,6 +66,7 @@ struct FileInfo {
   ImageParams params;      // Each file might have specific timing settings
   bool is_multi_frame = false;
   rgb_matrix::StreamIO *content_stream = nullptr;
+  bool streamed = false;   // First pass comes from the FrameQueue.
 };
 
 volatile bool interrupt_received = false;
@@ -115,35 +118,40 @@ static void CopyStream(rgb_matrix::StreamReader *r,
   }
 }
 
-// Load still image or animation.
-// Scale, so that it fits in "width" and "height" and store in "result".
-static bool LoadImageAndScale(const char *filename,
-                              int target_width, int target_height,
-                              bool fill_width, bool fill_height,
-                              std::vector<Magick::Image> *result,
-                              std::string *err_msg) {
-  std::vector<Magick::Image> frames;
+static int64_t FrameDelayUs(const Magick::Image &img, bool is_multi_frame,
+                            const ImageParams &params) {
+  int64_t delay_time_us;
+  if (is_multi_frame) {
+    delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
+  } else {
+    delay_time_us = params.wait_ms * 1000;  // single image.
+  }
+  if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
+  return delay_time_us;
+}
+
+// Read all frames of a still image or animation, as they are in the file.
+static bool ReadFrames(const char *filename,
+                       std::vector<Magick::Image> *frames,
+                       std::string *err_msg) {
   try {
-    readImages(&frames, filename);
+    readImages(frames, filename);
   } catch (std::exception& e) {
     if (e.what()) *err_msg = e.what();
     return false;
   }
-  if (frames.size() == 0) {
+  if (frames->size() == 0) {
     fprintf(stderr, "No image found.");
     return false;
   }
+  return true;
+}
 
-  // Put together the animation from single frames. GIFs can have nasty
-  // disposal modes, but they are handled nicely by coalesceImages()
-  if (frames.size() > 1) {
-    Magick::coalesceImages(result, frames.begin(), frames.end());
-  } else {
-    result->push_back(frames[0]);   // just a single still image.
-  }
-
-  const int img_width = (*result)[0].columns();
-  const int img_height = (*result)[0].rows();
+// Size an image of "img_width" x "img_height" is scaled to, so that it fits
+// in "target_width" and "target_height".
+static Magick::Geometry ScaledGeometry(int img_width, int img_height,
+                                       int target_width, int target_height,
+                                       bool fill_width, bool fill_height) {
   const float width_fraction = (float)target_width / img_width;
   const float height_fraction = (float)target_height / img_height;
   if (fill_width && fill_height) {
@@ -165,16 +173,483 @@ static bool LoadImageAndScale(const char *filename,
     // dito, vertical. Make things fit in horizontal space.
     target_height = (int) roundf(width_fraction * img_height);
   }
+  return Magick::Geometry(target_width, target_height);
+}
 
+// Load still image or animation.
+// Scale, so that it fits in "width" and "height" and store in "result".
+static bool LoadImageAndScale(const char *filename,
+                              int target_width, int target_height,
+                              bool fill_width, bool fill_height,
+                              std::vector<Magick::Image> *result,
+                              std::string *err_msg) {
+  std::vector<Magick::Image> frames;
+  if (!ReadFrames(filename, &frames, err_msg))
+    return false;
+
+  // Put together the animation from single frames. GIFs can have nasty
+  // disposal modes, but they are handled nicely by coalesceImages()
+  if (frames.size() > 1) {
+    Magick::coalesceImages(result, frames.begin(), frames.end());
+  } else {
+    result->push_back(frames[0]);   // just a single still image.
+  }
+
+  const Magick::Geometry size
+    = ScaledGeometry((*result)[0].columns(), (*result)[0].rows(),
+                     target_width, target_height, fill_width, fill_height);
   for (size_t i = 0; i < result->size(); ++i) {
-    (*result)[i].scale(Magick::Geometry(target_width, target_height));
+    (*result)[i].scale(size);
   }
 
   return true;
 }
 
-void DisplayAnimation(const FileInfo *file,
-                      RGBMatrix *matrix, FrameCanvas *offscreen_canvas) {
+// Set up "stream" for showing, if it is a compatible stream. Takes ownership
+// of "stream"; returns NULL if it is not usable.
+static FileInfo *OpenContentStream(rgb_matrix::StreamIO *stream,
+                                   const ImageParams &params,
+                                   FrameCanvas *scratch,
+                                   std::string *err_msg) {
+  StreamReader reader(stream);
+  if (!reader.GetNext(scratch, NULL)) {  // header+size ok ?
+    *err_msg += "; Can't read as image or compatible stream";
+    delete stream;
+    return NULL;
+  }
+  FileInfo *file_info = new FileInfo();
+  file_info->params = params;
+  file_info->content_stream = stream;
+  file_info->is_multi_frame = reader.GetNext(scratch, NULL);
+  return file_info;
+}
+
+// Open a stream file, memory mapped if "do_mmap" and possible.
+static rgb_matrix::StreamIO *OpenStreamFile(const char *filename,
+                                            bool do_mmap) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("Opening file");
+    return NULL;
+  }
+  if (do_mmap) {
+    rgb_matrix::MemMapViewInput *stream_input =
+      new rgb_matrix::MemMapViewInput(fd);
+    if (stream_input->IsInitialized()) {
+      return stream_input;
+    }
+    delete stream_input;
+    fd = open(filename, O_RDONLY);  // Closed by MemMapViewInput.
+    if (fd < 0) return NULL;
+  }
+  return new rgb_matrix::FileStreamIO(fd);
+}
+
+// Open a file previously written with -O. Returns NULL if it is not a
+// compatible stream.
+static FileInfo *OpenContentStream(const char *filename,
+                                   const ImageParams &params, bool do_mmap,
+                                   FrameCanvas *scratch,
+                                   std::string *err_msg) {
+  rgb_matrix::StreamIO *stream = OpenStreamFile(filename, do_mmap);
+  if (stream == NULL) return NULL;
+  return OpenContentStream(stream, params, scratch, err_msg);
+}
+
+// -- Cache of rendered files (-k), so that they don't need to be decoded and
+// scaled again when shown the next time.
+
+// Everything besides the file and the matrix options that changes how it
+// is rendered.
+static std::string RenderOptions(int width, int height, bool do_center) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "image-viewer;%dx%d;center=%d",
+           width, height, do_center);
+  return buffer;
+}
+
+// Key of the cached rendering of "filename". Still images store their
+// display time, so that is part of it.
+static std::string CacheKey(const char *filename,
+                            const RGBMatrix::Options &matrix_options,
+                            const ImageParams &params,
+                            const std::string &render_options) {
+  return rgb_matrix::StreamCache::MakeKey(
+    filename, matrix_options,
+    render_options + ";wait=" + std::to_string(params.wait_ms));
+}
+
+// Writes a rendering to the cache, if there is one. It only shows up there
+// with Commit(), so incomplete renderings are never used.
+class CacheWriter {
+public:
+  CacheWriter(const rgb_matrix::StreamCache *cache, const std::string &key)
+    : entry_(cache ? cache->CreateEntry(key) : NULL),
+      writer_(entry_ ? new rgb_matrix::StreamWriter(entry_) : NULL) {}
+
+  ~CacheWriter() {
+    delete writer_;
+    delete entry_;
+  }
+
+  void Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
+    if (writer_) writer_->Stream(frame, hold_time_us);
+  }
+
+  void Commit() {
+    if (entry_) entry_->Commit();
+  }
+
+private:
+  rgb_matrix::StreamCacheEntry *const entry_;
+  rgb_matrix::StreamWriter *const writer_;
+};
+
+// Puts together the frames of an animation one at a time, the same way
+// Magick::coalesceImages() does for all of them at once. So only the
+// current frame needs to be kept, not a second copy of the whole animation.
+class FrameCoalescer {
+public:
+  FrameCoalescer() : width_(0), height_(0) {}
+
+  // Returns the full picture shown with "frame", which is the next frame
+  // of the animation.
+  Magick::Image Add(Magick::Image *frame) {
+    const Magick::Geometry page = frame->page();
+    if (base_.empty()) {
+      width_ = page.width() > 0 ? page.width() : frame->columns();
+      height_ = page.height() > 0 ? page.height() : frame->rows();
+      base_.assign(4 * width_ * height_, 0);  // Transparent.
+    }
+    const int frame_width = frame->columns();
+    const int frame_height = frame->rows();
+    const int x_offset = page.xNegative() ? -(int)page.xOff() : page.xOff();
+    const int y_offset = page.yNegative() ? -(int)page.yOff() : page.yOff();
+    frame_pixels_.resize(4 * frame_width * frame_height);
+    frame->write(0, 0, frame_width, frame_height, "RGBA", Magick::CharPixel,
+                 frame_pixels_.data());
+
+    // Draw the frame over what was there before.
+    std::vector<uint8_t> result = base_;
+    const int x_start = std::max(0, x_offset);
+    const int x_end = std::min(width_, x_offset + frame_width);
+    const int y_start = std::max(0, y_offset);
+    const int y_end = std::min(height_, y_offset + frame_height);
+    for (int y = y_start; y < y_end; ++y) {
+      const uint8_t *src = &frame_pixels_[4 * ((y - y_offset) * frame_width
+                                               + x_start - x_offset)];
+      uint8_t *dst = &result[4 * (y * width_ + x_start)];
+      for (int x = x_start; x < x_end; ++x, src += 4, dst += 4) {
+        const int alpha = src[3];
+        if (alpha == 0) continue;
+        for (int c = 0; c < 3; ++c) {
+          dst[c] = (src[c] * alpha + dst[c] * (255 - alpha)) / 255;
+        }
+        dst[3] = alpha + dst[3] * (255 - alpha) / 255;
+      }
+    }
+
+    // What the next frame is drawn over depends on the disposal method.
+    switch (frame->gifDisposeMethod()) {
+    case 2:  // Background: the area of this frame is cleared.
+      base_ = result;
+      for (int y = y_start; y < y_end; ++y) {
+        std::fill(&base_[4 * (y * width_ + x_start)],
+                  &base_[4 * (y * width_ + x_end)], 0);
+      }
+      break;
+    case 3:  // Previous: as if this frame was never there.
+      break;
+    default:
+      base_ = result;
+    }
+    return Magick::Image(width_, height_, "RGBA", Magick::CharPixel,
+                         result.data());
+  }
+
+private:
+  int width_, height_;
+  std::vector<uint8_t> base_;          // RGBA picture the next frame is on.
+  std::vector<uint8_t> frame_pixels_;
+};
+
+// In streaming mode, hands the rendered frames from the ImageLoader to the
+// display. The loader renders into canvases from a fixed pool, which the
+// display returns once shown, so at most that many frames are prepared
+// ahead. Likewise, only a limited number of files is queued, as streams
+// and cached files are shown without taking canvases from the pool.
+class FrameQueue {
+public:
+  struct Item {
+    enum Kind { FILE_START, FRAME, FILE_END, LIST_END };
+    Item() : kind(LIST_END), file(NULL), canvas(NULL), delay_us(0) {}
+    Item(Kind k, FileInfo *f, FrameCanvas *c = NULL, int64_t d = 0)
+      : kind(k), file(f), canvas(c), delay_us(d) {}
+    Kind kind;
+    FileInfo *file;
+    FrameCanvas *canvas;      // FRAME only.
+    int64_t delay_us;         // FRAME only.
+  };
+
+  // At most "max_files" files are queued or shown at a time.
+  explicit FrameQueue(int max_files)
+    : max_files_(max_files), files_(0), closed_(false), skipped_(NULL) {
+    pthread_cond_init(&changed_, NULL);
+  }
+  ~FrameQueue() { pthread_cond_destroy(&changed_); }
+
+  // -- Loader side.
+
+  // Wait until another file can be queued. Returns false once the queue
+  // is closed. Each file is given back with ReleaseFile().
+  bool AcquireFile() {
+    rgb_matrix::MutexLock l(&mutex_);
+    while (files_ >= max_files_ && !closed_) mutex_.WaitOn(&changed_);
+    if (closed_) return false;
+    ++files_;
+    return true;
+  }
+
+  // A canvas to render the next frame into. Waits until one is free.
+  // Returns NULL once the queue is closed.
+  FrameCanvas *AcquireCanvas() {
+    rgb_matrix::MutexLock l(&mutex_);
+    while (free_.empty() && !closed_) mutex_.WaitOn(&changed_);
+    if (closed_) return NULL;
+    FrameCanvas *const canvas = free_.back();
+    free_.pop_back();
+    return canvas;
+  }
+
+  void Push(const Item &item) {
+    rgb_matrix::MutexLock l(&mutex_);
+    if (item.kind == Item::FILE_START) skipped_ = NULL;
+    ready_.push_back(item);
+    pthread_cond_broadcast(&changed_);
+  }
+
+  // True if no more frames of "file" are needed.
+  bool IsSkipped(const FileInfo *file) {
+    rgb_matrix::MutexLock l(&mutex_);
+    return closed_ || skipped_ == file;
+  }
+
+  bool closed() {
+    rgb_matrix::MutexLock l(&mutex_);
+    return closed_;
+  }
+
+  // -- Both sides.
+
+  // A file from AcquireFile() is shown, or was not queued after all.
+  void ReleaseFile() {
+    rgb_matrix::MutexLock l(&mutex_);
+    --files_;
+    pthread_cond_broadcast(&changed_);
+  }
+
+  // -- Display side.
+
+  void ReleaseCanvas(FrameCanvas *canvas) {
+    rgb_matrix::MutexLock l(&mutex_);
+    free_.push_back(canvas);
+    pthread_cond_broadcast(&changed_);
+  }
+
+  // Get the next item, waiting at most "timeout_ms".
+  bool Pop(Item *item, long timeout_ms) {
+    rgb_matrix::MutexLock l(&mutex_);
+    if (ready_.empty()) mutex_.WaitOn(&changed_, timeout_ms);
+    if (ready_.empty()) return false;
+    *item = ready_.front();
+    ready_.pop_front();
+    return true;
+  }
+
+  // The display is done with "file"; the loader can stop rendering it.
+  void Skip(const FileInfo *file) {
+    rgb_matrix::MutexLock l(&mutex_);
+    skipped_ = file;
+  }
+
+  // Stop the loader.
+  void Close() {
+    rgb_matrix::MutexLock l(&mutex_);
+    closed_ = true;
+    pthread_cond_broadcast(&changed_);
+  }
+
+private:
+  rgb_matrix::Mutex mutex_;
+  pthread_cond_t changed_;
+  const int max_files_;
+  int files_;                    // Files acquired, but not yet released.
+  std::vector<FrameCanvas*> free_;
+  std::deque<Item> ready_;
+  bool closed_;
+  const FileInfo *skipped_;
+};
+
+// Streaming mode: decodes, scales and renders the files in the order they
+// are shown, while the display shows the frames rendered before.
+class ImageLoader : public rgb_matrix::Thread {
+public:
+  struct Entry {
+    const char *filename;
+    ImageParams params;
+  };
+
+  ImageLoader(const std::vector<Entry> &entries, bool forever, bool shuffle,
+              bool do_center, bool do_mmap, int width, int height,
+              const rgb_matrix::StreamCache *cache,
+              const RGBMatrix::Options &matrix_options,
+              const std::string &render_options, FrameQueue *queue)
+    : entries_(entries), forever_(forever), shuffle_(shuffle),
+      do_center_(do_center), do_mmap_(do_mmap),
+      width_(width), height_(height), cache_(cache),
+      matrix_options_(matrix_options), render_options_(render_options),
+      queue_(queue) {}
+
+  virtual ~ImageLoader() { WaitStopped(); }
+
+  virtual void Run() {
+    std::vector<Entry> order = entries_;
+    bool any_shown;
+    do {
+      if (shuffle_) {
+        std::random_shuffle(order.begin(), order.end());
+      }
+      any_shown = false;
+      for (size_t i = 0; i < order.size() && queue_->AcquireFile(); ++i) {
+        if (LoadFile(order[i])) {
+          any_shown = true;
+        } else {
+          queue_->ReleaseFile();
+        }
+      }
+    } while (forever_ && any_shown && !queue_->closed());
+    queue_->Push(FrameQueue::Item(FrameQueue::Item::LIST_END, NULL));
+  }
+
+private:
+  bool LoadFile(const Entry &entry) {
+    std::string err_msg;
+    std::string cache_key;
+    if (cache_) {
+      cache_key = CacheKey(entry.filename, matrix_options_, entry.params,
+                           render_options_);
+      rgb_matrix::StreamIO *cached = cache_->Open(cache_key, do_mmap_);
+      if (cached && ShowStream(cached, entry, &err_msg)) {
+        return true;
+      }
+    }
+
+    std::vector<Magick::Image> frames;
+    if (ReadFrames(entry.filename, &frames, &err_msg)) {
+      RenderFrames(entry, &frames, cache_key);
+      return true;
+    }
+
+    // Not an image; maybe one of our streams. These are shown directly.
+    rgb_matrix::StreamIO *stream = OpenStreamFile(entry.filename, do_mmap_);
+    if (stream == NULL || !ShowStream(stream, entry, &err_msg)) {
+      fprintf(stderr, "%s skipped: Unable to open (%s)\n",
+              entry.filename, err_msg.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Have the display show a stream directly. Takes ownership of "stream".
+  bool ShowStream(rgb_matrix::StreamIO *stream, const Entry &entry,
+                  std::string *err_msg) {
+    FrameCanvas *scratch = queue_->AcquireCanvas();
+    if (scratch == NULL) {
+      delete stream;
+      return false;
+    }
+    FileInfo *file_info = OpenContentStream(stream, entry.params,
+                                            scratch, err_msg);
+    queue_->ReleaseCanvas(scratch);
+    if (file_info == NULL) return false;
+    queue_->Push(FrameQueue::Item(FrameQueue::Item::FILE_START, file_info));
+    return true;
+  }
+
+  void RenderFrames(const Entry &entry, std::vector<Magick::Image> *frames,
+                    const std::string &cache_key) {
+    FileInfo *file_info = new FileInfo();
+    file_info->params = entry.params;
+    file_info->is_multi_frame = frames->size() > 1;
+    file_info->streamed = true;
+    // Recorded for further loops.
+    file_info->content_stream = new rgb_matrix::MemStreamIO();
+    rgb_matrix::StreamWriter out(file_info->content_stream);
+    queue_->Push(FrameQueue::Item(FrameQueue::Item::FILE_START, file_info));
+
+    CacheWriter cache(cache_, cache_key);
+    FrameCoalescer coalescer;
+    size_t i;
+    for (i = 0; i < frames->size(); ++i) {
+      if (queue_->IsSkipped(file_info)) break;
+      Magick::Image &frame = (*frames)[i];
+      const int64_t delay_us = FrameDelayUs(frame, file_info->is_multi_frame,
+                                            entry.params);
+      Magick::Image img = file_info->is_multi_frame
+        ? coalescer.Add(&frame) : frame;
+      frame = Magick::Image();  // Not needed anymore; free right away.
+      img.scale(ScaledGeometry(img.columns(), img.rows(), width_, height_,
+                               false, false));
+      FrameCanvas *canvas = queue_->AcquireCanvas();
+      if (canvas == NULL) break;
+      StoreInStream(img, delay_us, do_center_, canvas, &out);
+      cache.Stream(*canvas, delay_us);
+      queue_->Push(FrameQueue::Item(FrameQueue::Item::FRAME, file_info,
+                                    canvas, delay_us));
+    }
+    if (i == frames->size()) cache.Commit();
+    queue_->Push(FrameQueue::Item(FrameQueue::Item::FILE_END, file_info));
+  }
+
+  const std::vector<Entry> entries_;
+  const bool forever_, shuffle_, do_center_, do_mmap_;
+  const int width_, height_;
+  const rgb_matrix::StreamCache *const cache_;
+  const RGBMatrix::Options matrix_options_;
+  const std::string render_options_;
+  FrameQueue *const queue_;
+};
+
+// Next frame of the file currently streamed. Returns false at its end.
+static bool NextStreamedFrame(FrameQueue *queue, FrameCanvas **canvas,
+                              uint32_t *delay_us) {
+  FrameQueue::Item item;
+  while (!interrupt_received) {
+    if (!queue->Pop(&item, 100)) continue;
+    if (item.kind != FrameQueue::Item::FRAME) return false;
+    *canvas = item.canvas;
+    *delay_us = item.delay_us;
+    return true;
+  }
+  return false;
+}
+
+// Drop the rest of the frames of "file", e.g. if its display time is over
+// before it was shown completely.
+static void SkipStreamedFrames(FrameQueue *queue, const FileInfo *file) {
+  queue->Skip(file);
+  FrameQueue::Item item;
+  while (!interrupt_received) {
+    if (!queue->Pop(&item, 100)) continue;
+    if (item.kind != FrameQueue::Item::FRAME) return;
+    queue->ReleaseCanvas(item.canvas);
+  }
+}
+
+// Show "file". If it is streamed, the frames of the first loop come from
+// the "queue", further loops from the stream recorded while rendering.
+void DisplayAnimation(const FileInfo *file, FrameQueue *queue,
+                      RGBMatrix *matrix, FrameCanvas **offscreen_canvas) {
   const tmillis_t duration_ms = (file->is_multi_frame
                                  ? file->params.anim_duration_ms
                                  : file->params.wait_ms);
@@ -182,24 +657,106 @@ void DisplayAnimation(const FileInfo *file,
   int loops = file->params.loops;
   const tmillis_t end_time_ms = GetTimeInMillis() + duration_ms;
   const tmillis_t override_anim_delay = file->params.anim_delay_ms;
+  bool from_queue = file->streamed;
   for (int k = 0;
        (loops < 0 || k < loops)
          && !interrupt_received
          && GetTimeInMillis() < end_time_ms;
        ++k) {
     uint32_t delay_us = 0;
-    while (!interrupt_received && GetTimeInMillis() <= end_time_ms
-           && reader.GetNext(offscreen_canvas, &delay_us)) {
+    while (!interrupt_received && GetTimeInMillis() <= end_time_ms) {
+      FrameCanvas *frame = *offscreen_canvas;
+      if (from_queue) {
+        if (!NextStreamedFrame(queue, &frame, &delay_us)) {
+          from_queue = false;
+          break;
+        }
+      } else if (!reader.GetNext(frame, &delay_us)) {
+        break;
+      }
       const tmillis_t anim_delay_ms =
         override_anim_delay >= 0 ? override_anim_delay : delay_us / 1000;
       const tmillis_t start_wait_ms = GetTimeInMillis();
-      offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas,
-                                             file->params.vsync_multiple);
+      FrameCanvas *previous = matrix->SwapOnVSync(frame,
+                                                  file->params.vsync_multiple);
+      if (frame == *offscreen_canvas) {
+        *offscreen_canvas = previous;
+      } else {
+        queue->ReleaseCanvas(previous);
+      }
       const tmillis_t time_already_spent = GetTimeInMillis() - start_wait_ms;
       SleepMillis(anim_delay_ms - time_already_spent);
     }
     reader.Rewind();
   }
+  if (from_queue) {
+    SkipStreamedFrames(queue, file);
+  }
+}
+
+// Show the files while the ImageLoader prepares them, with at most
+// "buffer_frames" frames rendered ahead.
+static int ShowStreaming(char **filenames, int filename_count,
+                         std::map<const void *, ImageParams> &filename_params,
+                         int buffer_frames, bool do_forever, bool do_shuffle,
+                         bool do_center, bool do_mmap,
+                         const rgb_matrix::StreamCache *cache,
+                         const RGBMatrix::Options &matrix_options,
+                         const std::string &render_options,
+                         RGBMatrix *matrix) {
+  std::vector<ImageLoader::Entry> entries;
+  for (int i = 0; i < filename_count; ++i) {
+    ImageLoader::Entry entry;
+    entry.filename = filenames[i];
+    entry.params = filename_params[filenames[i]];
+    // Same adjustment as for preloaded files: endless animations are only
+    // shown once if there are other files. (A single file is shown forever,
+    // which is set up once it is rendered, see below.)
+    if (filename_count > 1 && entry.params.loops < 0
+        && entry.params.anim_duration_ms == distant_future) {
+      entry.params.loops = 1;
+    }
+    entries.push_back(entry);
+  }
+
+  // The file shown, and at most as many files ahead as frames.
+  FrameQueue queue(buffer_frames + 1);
+  for (int i = 0; i < buffer_frames; ++i) {
+    queue.ReleaseCanvas(matrix->CreateFrameCanvas());
+  }
+  FrameCanvas *offscreen_canvas = matrix->CreateFrameCanvas();
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  ImageLoader loader(entries, do_forever, do_shuffle, do_center, do_mmap,
+                     matrix->width(), matrix->height(), cache,
+                     matrix_options, render_options, &queue);
+  loader.Start();
+
+  FrameQueue::Item item;
+  while (!interrupt_received) {
+    if (!queue.Pop(&item, 100)) continue;
+    if (item.kind == FrameQueue::Item::LIST_END) break;
+    if (item.kind != FrameQueue::Item::FILE_START) continue;
+    // The loader doesn't use the parameters anymore once the file is
+    // queued, so this doesn't change how it is rendered.
+    if (filename_count == 1) item.file->params.wait_ms = distant_future;
+    DisplayAnimation(item.file, &queue, matrix, &offscreen_canvas);
+    delete item.file->content_stream;
+    delete item.file;
+    queue.ReleaseFile();
+  }
+
+  if (interrupt_received) {
+    fprintf(stderr, "Caught signal. Exiting.\n");
+  }
+  queue.Close();
+  loader.WaitStopped();
+
+  matrix->Clear();
+  delete matrix;
+  return 0;
 }
 
 static int usage(const char *progname) {
@@ -210,6 +767,9 @@ static int usage(const char *progname) {
           "\t-O<streamfile>            : Output to stream-file instead of matrix (Don't need to be root).\n"
           "\t-C                        : Center images.\n"
           "\t-m                        : if this is a stream, mmap() it. This can work around IO latencies in SD-card and refilling kernel buffers. This will use physical memory so only use if you have enough to map file size\n"
+          "\t-b<frames>                : Streaming: decode images while showing them, preparing at most <frames> frames (and files) ahead.\n"
+          "\t                            Starts right away and needs much less memory for large animations and playlists.\n"
+          "\t-k<directory>             : Cache rendered images in this directory, so they show up faster next time.\n"
 
           "\nThese options affect images FOLLOWING them on the command line,\n"
           "so it is possible to have different options for each image\n"
@@ -266,6 +826,8 @@ int main(int argc, char *argv[]) {
   bool do_forever = false;
   bool do_center = false;
   bool do_shuffle = false;
+  int stream_frames = 0;
+  const char *cache_dir = NULL;
 
   // We remember ImageParams for each image, which will change whenever
   // there is a flag modifying them. This map keeps track of filenames
@@ -285,7 +847,7 @@ int main(int argc, char *argv[]) {
   const char *stream_output = NULL;
 
   int opt;
-  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sO:V:D:m")) != -1) {
+  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sO:V:D:mb:k:")) != -1) {
     switch (opt) {
     case 'w':
       img_param.wait_ms = roundf(atof(optarg) * 1000.0f);
@@ -302,6 +864,12 @@ int main(int argc, char *argv[]) {
     case 'm':
       do_mmap = true;
       break;
+    case 'b':
+      stream_frames = atoi(optarg);
+      break;
+    case 'k':
+      cache_dir = strdup(optarg);
+      break;
     case 'f':
       do_forever = true;
       break;
@@ -386,6 +954,19 @@ int main(int argc, char *argv[]) {
     global_stream_writer = new rgb_matrix::StreamWriter(stream_io);
   }
 
+  rgb_matrix::StreamCache *cache = NULL;
+  if (cache_dir) {
+    cache = new rgb_matrix::StreamCache(cache_dir);
+  }
+  const std::string render_options
+    = RenderOptions(matrix->width(), matrix->height(), do_center);
+  if (stream_frames > 0 && stream_output == NULL) {
+    return ShowStreaming(argv + optind, argc - optind, filename_params,
+                         stream_frames, do_forever, do_shuffle, do_center,
+                         do_mmap, cache, matrix_options, render_options,
+                         matrix);
+  }
+
   const tmillis_t start_load = GetTimeInMillis();
   fprintf(stderr, "Loading %d files...\n", argc - optind);
   // Preparing all the images beforehand as the Pi might be too slow to
@@ -396,60 +977,48 @@ int main(int argc, char *argv[]) {
     FileInfo *file_info = NULL;
 
     std::string err_msg;
+    std::string cache_key;
+    if (cache) {
+      cache_key = CacheKey(filename, matrix_options, filename_params[filename],
+                           render_options);
+      rgb_matrix::StreamIO *cached = cache->Open(cache_key, do_mmap);
+      if (cached) {
+        file_info = OpenContentStream(cached, filename_params[filename],
+                                      offscreen_canvas, &err_msg);
+      }
+    }
+
     std::vector<Magick::Image> image_sequence;
-    if (LoadImageAndScale(filename, matrix->width(), matrix->height(),
-                          fill_width, fill_height, &image_sequence, &err_msg)) {
+    if (file_info) {
+      if (global_stream_writer) {
+        StreamReader reader(file_info->content_stream);
+        CopyStream(&reader, global_stream_writer, offscreen_canvas);
+      }
+    } else if (LoadImageAndScale(filename, matrix->width(), matrix->height(),
+                                 fill_width, fill_height, &image_sequence,
+                                 &err_msg)) {
       file_info = new FileInfo();
       file_info->params = filename_params[filename];
       file_info->content_stream = new rgb_matrix::MemStreamIO();
       file_info->is_multi_frame = image_sequence.size() > 1;
       rgb_matrix::StreamWriter out(file_info->content_stream);
+      CacheWriter cache_writer(cache, cache_key);
       for (size_t i = 0; i < image_sequence.size(); ++i) {
         const Magick::Image &img = image_sequence[i];
-        int64_t delay_time_us;
-        if (file_info->is_multi_frame) {
-          delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
-        } else {
-          delay_time_us = file_info->params.wait_ms * 1000;  // single image.
-        }
-        if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
-        StoreInStream(img, delay_time_us, do_center, offscreen_canvas,
+        const int64_t delay_us = FrameDelayUs(img, file_info->is_multi_frame,
+                                              file_info->params);
+        StoreInStream(img, delay_us, do_center, offscreen_canvas,
                       global_stream_writer ? global_stream_writer : &out);
+        cache_writer.Stream(*offscreen_canvas, delay_us);
       }
+      cache_writer.Commit();
     } else {
       // Ok, not an image. Let's see if it is one of our streams.
-      int fd = open(filename, O_RDONLY);
-      if (fd >= 0) {
-        file_info = new FileInfo();
-        file_info->params = filename_params[filename];
-        if (do_mmap) {
-          rgb_matrix::MemMapViewInput *stream_input =
-            new rgb_matrix::MemMapViewInput(fd);
-          if (stream_input->IsInitialized()) {
-            file_info->content_stream = stream_input;
-          } else {
-            delete stream_input;
-          }
-        }
-        if (!file_info->content_stream) {
-          file_info->content_stream = new rgb_matrix::FileStreamIO(fd);
-        }
+      file_info = OpenContentStream(filename, filename_params[filename],
+                                    do_mmap, offscreen_canvas, &err_msg);
+      if (file_info && global_stream_writer) {
         StreamReader reader(file_info->content_stream);
-        if (reader.GetNext(offscreen_canvas, NULL)) {  // header+size ok
-          file_info->is_multi_frame = reader.GetNext(offscreen_canvas, NULL);
-          reader.Rewind();
-          if (global_stream_writer) {
-            CopyStream(&reader, global_stream_writer, offscreen_canvas);
-          }
-        } else {
-          err_msg += "; Can't read as image or compatible stream";
-          delete file_info->content_stream;
-          delete file_info;
-          file_info = NULL;
-        }
-      }
-      else {
-        perror("Opening file");
+        CopyStream(&reader, global_stream_writer, offscreen_canvas);
       }
     }
 
@@ -506,7 +1075,7 @@ int main(int argc, char *argv[]) {
       std::random_shuffle(file_imgs.begin(), file_imgs.end());
     }
     for (size_t i = 0; i < file_imgs.size() && !interrupt_received; ++i) {
-      DisplayAnimation(file_imgs[i], matrix, offscreen_canvas);
+      DisplayAnimation(file_imgs[i], NULL, matrix, &offscreen_canvas);
     }
   } while (do_forever && !interrupt_received);
 
@@ -15,6 +15,7 @@
 
 #include "led-matrix.h"
 #include "graphics.h"
+#include "scroll-strip.h"
 
 #include <algorithm>
 #include <fstream>
@@ -113,6 +114,30 @@ static bool ReadLineOnChange(const char *filename, std::string *out,
   return true;
 }
 
+// Render the text once into a strip that has a blank margin on either side,
+// so that the text can scroll in and out of view by just moving the visible
+// window. Text position zero is at strip column "margin".
+// Returns the strip and the length of the text in pixels in "length".
+static ScrollStrip *RenderStrip(const std::string &line,
+                                const Font &font, const Font *outline_font,
+                                const Color &color, const Color &bg_color,
+                                const Color &outline_color,
+                                int letter_spacing, int y, int margin,
+                                int height, int *length) {
+  *length = rgb_matrix::TextWidth(font, line.c_str(), letter_spacing);
+
+  ScrollStrip *strip = new ScrollStrip(*length + 2 * margin, height);
+  strip->Fill(bg_color.r, bg_color.g, bg_color.b);
+  if (outline_font) {
+    rgb_matrix::DrawText(strip, *outline_font, margin - 1, y + font.baseline(),
+                         outline_color, NULL,
+                         line.c_str(), letter_spacing - 2);
+  }
+  rgb_matrix::DrawText(strip, font, margin, y + font.baseline(),
+                       color, NULL, line.c_str(), letter_spacing);
+  return strip;
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options matrix_options;
   rgb_matrix::RuntimeOptions runtime_opt;
@@ -264,19 +289,36 @@ int main(int argc, char *argv[]) {
   int y = y_orig;
   int length = 0;
 
+  // When scrolling, the text is only rendered once into a strip, of which
+  // we show a moving window.
+  ScrollStrip *strip = NULL;
+  const int strip_margin = canvas->width() + abs(x_orig);
+
   struct timespec next_frame = {0, 0};
 
   uint64_t frame_counter = 0;
   while (!interrupt_received && loops != 0) {
     if (input_file && ReadLineOnChange(input_file, &line, &last_change)) {
       x = x_orig;
+      delete strip;
+      strip = NULL;
+    }
+    if (strip == NULL && speed > 0) {
+      strip = RenderStrip(line, font, outline_font,
+                          color, bg_color, outline_color,
+                          letter_spacing, y, strip_margin,
+                          canvas->height(), &length);
     }
     ++frame_counter;
-    offscreen_canvas->Fill(bg_color.r, bg_color.g, bg_color.b);
     const bool draw_on_frame = (blink_on <= 0)
       || (frame_counter % (blink_on + blink_off) < (uint64_t)blink_on);
 
-    if (draw_on_frame) {
+    if (!draw_on_frame) {
+      offscreen_canvas->Fill(bg_color.r, bg_color.g, bg_color.b);
+    } else if (strip) {
+      strip->Blit(offscreen_canvas, strip_margin - x);
+    } else {
+      offscreen_canvas->Fill(bg_color.r, bg_color.g, bg_color.b);
       if (outline_font) {
         // The outline font, we need to write with a negative (-2) text-spacing,
         // as we want to have the same letter pitch as the regular text that
@@ -317,6 +359,7 @@ int main(int argc, char *argv[]) {
   }
 
   // Finished. Shut down the RGB matrix.
+  delete strip;
   canvas->Clear();
   delete canvas;
 
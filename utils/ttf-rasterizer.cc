@@ -0,0 +1,230 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Rasterize a TrueType/OpenType font offline into a grayscale (anti-aliased)
+// BDF font, which can be loaded with Font::LoadFont() like any other font.
+// All the expensive work (outline rendering, coverage computation) happens
+// here once, so drawing stays a simple table lookup per pixel.
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct CodepointRange {
+  uint32_t first;
+  uint32_t last;
+};
+
+struct RasterGlyph {
+  uint32_t codepoint;
+  int advance;
+  int width, height;
+  int x_offset, y_offset;     // Of the bottom left corner to the origin.
+  std::vector<uint8_t> coverage;   // 0..255, width * height
+};
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] <font-file> <output.bdf>\n", progname);
+  fprintf(stderr, "Rasterizes a TrueType/OpenType font into a grayscale "
+          "BDF font.\nOptions:\n"
+          "\t-s <pixels>     : Pixel height of the font. Default 16\n"
+          "\t-b <bits>       : Bits of coverage per pixel: 1, 2, 4 or 8. "
+          "Default 4\n"
+          "\t-r <first-last> : Range of codepoints to include, e.g. "
+          "0x20-0x7e.\n"
+          "\t                  Can be given multiple times. "
+          "Default: ASCII and Latin-1\n");
+  return 1;
+}
+
+static bool ParseRange(const char *arg, CodepointRange *range) {
+  char *end;
+  range->first = strtoul(arg, &end, 0);
+  if (*end == '\0') {
+    range->last = range->first;
+    return true;
+  }
+  if (*end != '-') return false;
+  range->last = strtoul(end + 1, &end, 0);
+  return *end == '\0' && range->first <= range->last;
+}
+
+static bool RasterizeGlyph(FT_Face face, uint32_t codepoint,
+                           RasterGlyph *glyph) {
+  if (FT_Get_Char_Index(face, codepoint) == 0)
+    return false;
+  if (FT_Load_Char(face, codepoint, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL))
+    return false;
+  const FT_GlyphSlot slot = face->glyph;
+  const FT_Bitmap &bitmap = slot->bitmap;
+  if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY && bitmap.rows > 0)
+    return false;
+  glyph->codepoint = codepoint;
+  glyph->advance = (slot->advance.x + 32) >> 6;
+  glyph->width = bitmap.width;
+  glyph->height = bitmap.rows;
+  glyph->x_offset = slot->bitmap_left;
+  glyph->y_offset = slot->bitmap_top - (int)bitmap.rows;
+  glyph->coverage.resize(glyph->width * glyph->height);
+  for (int y = 0; y < glyph->height; ++y) {
+    const uint8_t *row = bitmap.buffer + y * bitmap.pitch;
+    std::copy(row, row + glyph->width,
+              glyph->coverage.begin() + y * glyph->width);
+  }
+  return true;
+}
+
+static void WriteGlyph(FILE *out, const RasterGlyph &g, int bits_per_pixel) {
+  const int max_level = (1 << bits_per_pixel) - 1;
+  fprintf(out, "STARTCHAR U+%04X\n", g.codepoint);
+  fprintf(out, "ENCODING %u\n", g.codepoint);
+  fprintf(out, "DWIDTH %d 0\n", g.advance);
+  fprintf(out, "BBX %d %d %d %d\n", g.width, g.height, g.x_offset, g.y_offset);
+  fprintf(out, "BITMAP\n");
+  const int row_bytes = (g.width * bits_per_pixel + 7) / 8;
+  std::vector<uint8_t> packed(row_bytes);
+  for (int y = 0; y < g.height; ++y) {
+    std::fill(packed.begin(), packed.end(), 0);
+    for (int x = 0; x < g.width; ++x) {
+      const int level = (g.coverage[y * g.width + x] * max_level + 127) / 255;
+      const int bit = x * bits_per_pixel;
+      packed[bit / 8] |= level << (8 - bits_per_pixel - bit % 8);
+    }
+    for (int i = 0; i < row_bytes; ++i) fprintf(out, "%02X", packed[i]);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "ENDCHAR\n");
+}
+
+int main(int argc, char *argv[]) {
+  int pixel_height = 16;
+  int bits_per_pixel = 4;
+  std::vector<CodepointRange> ranges;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:b:r:")) != -1) {
+    switch (opt) {
+    case 's':
+      pixel_height = atoi(optarg);
+      break;
+    case 'b':
+      bits_per_pixel = atoi(optarg);
+      break;
+    case 'r': {
+      CodepointRange range;
+      if (!ParseRange(optarg, &range)) {
+        fprintf(stderr, "Invalid range '%s'\n", optarg);
+        return usage(argv[0]);
+      }
+      ranges.push_back(range);
+      break;
+    }
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2)
+    return usage(argv[0]);
+  if (pixel_height < 1) {
+    fprintf(stderr, "Invalid pixel height %d\n", pixel_height);
+    return usage(argv[0]);
+  }
+  if (bits_per_pixel != 1 && bits_per_pixel != 2 && bits_per_pixel != 4
+      && bits_per_pixel != 8) {
+    fprintf(stderr, "Bits per pixel need to be one of 1, 2, 4 or 8\n");
+    return usage(argv[0]);
+  }
+  if (ranges.empty()) {
+    const CodepointRange ascii = { 0x20, 0x7e };
+    const CodepointRange latin1 = { 0xa0, 0xff };
+    const CodepointRange replacement = { 0xfffd, 0xfffd };
+    ranges.push_back(ascii);
+    ranges.push_back(latin1);
+    ranges.push_back(replacement);
+  }
+  const char *font_file = argv[optind];
+  const char *output_file = argv[optind + 1];
+
+  FT_Library library;
+  FT_Face face;
+  if (FT_Init_FreeType(&library)) {
+    fprintf(stderr, "Couldn't initialize FreeType\n");
+    return 1;
+  }
+  if (FT_New_Face(library, font_file, 0, &face)) {
+    fprintf(stderr, "Couldn't load font '%s'\n", font_file);
+    return 1;
+  }
+  if (FT_Set_Pixel_Sizes(face, 0, pixel_height)) {
+    fprintf(stderr, "Can't use font at %d pixels height\n", pixel_height);
+    return 1;
+  }
+
+  std::vector<RasterGlyph> glyphs;
+  for (size_t r = 0; r < ranges.size(); ++r) {
+    for (uint32_t cp = ranges[r].first; cp <= ranges[r].last; ++cp) {
+      RasterGlyph glyph;
+      if (RasterizeGlyph(face, cp, &glyph))
+        glyphs.push_back(glyph);
+      if (cp == ranges[r].last) break;  // Don't overflow at 0xffffffff
+    }
+  }
+  if (glyphs.empty()) {
+    fprintf(stderr, "None of the requested characters are in the font.\n");
+    return 1;
+  }
+
+  const int ascent = (face->size->metrics.ascender + 63) >> 6;
+  const int descent = (-face->size->metrics.descender + 63) >> 6;
+  int max_advance = 0;
+  for (size_t i = 0; i < glyphs.size(); ++i)
+    max_advance = std::max(max_advance, glyphs[i].advance);
+
+  FILE *out = fopen(output_file, "w");
+  if (out == NULL) {
+    perror("Couldn't open output file");
+    return 1;
+  }
+  fprintf(out, "STARTFONT 2.3\n");
+  fprintf(out, "FONT -%s-%s-%d-%dbpp\n", face->family_name,
+          face->style_name, pixel_height, bits_per_pixel);
+  // The last value is the bits per pixel of the grayscale BDF format.
+  fprintf(out, "SIZE %d 72 72 %d\n", pixel_height, bits_per_pixel);
+  fprintf(out, "FONTBOUNDINGBOX %d %d 0 %d\n",
+          max_advance, ascent + descent, -descent);
+  fprintf(out, "STARTPROPERTIES 2\nFONT_ASCENT %d\nFONT_DESCENT %d\n"
+          "ENDPROPERTIES\n", ascent, descent);
+  fprintf(out, "CHARS %d\n", (int)glyphs.size());
+  for (size_t i = 0; i < glyphs.size(); ++i)
+    WriteGlyph(out, glyphs[i], bits_per_pixel);
+  fprintf(out, "ENDFONT\n");
+  if (fclose(out) != 0) {
+    perror("Couldn't write output file");
+    return 1;
+  }
+
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+  fprintf(stderr, "Wrote %d glyphs, %d pixels high, %d bits per pixel.\n",
+          (int)glyphs.size(), ascent + descent, bits_per_pixel);
+  return 0;
+}
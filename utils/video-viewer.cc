@@ -12,9 +12,8 @@
 // the led-image-viewer.
 //
 // Pull requests are welcome to address
-//    * Use hardware acceleration if possible. The Pi does have some
-//      acceleration features IIRC, so if we could use these, that would be
-//      great.
+//    * Use more hardware acceleration. The V4L2 decoders are used with -H,
+//      but scaling could also be done in hardware.
 //    * Other improvements that could reduce the flicker on a Raspberry Pi.
 //      Currently it seems to create flicker in particular when decoding larger
 //      videos due to memory bandwidth overload (?). Might already be fixed
@@ -46,35 +45,398 @@ extern "C" {
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "led-matrix.h"
 #include "content-streamer.h"
+#include "graphics.h"
+#include "thread.h"
+#include "yuv-scaler.h"
 
+using rgb_matrix::Color;
 using rgb_matrix::FrameCanvas;
 using rgb_matrix::RGBMatrix;
+using rgb_matrix::StreamCache;
+using rgb_matrix::StreamReader;
 using rgb_matrix::StreamWriter;
 using rgb_matrix::StreamIO;
+using rgb_matrix::YUV420Image;
+using rgb_matrix::YUV420Scaler;
 
 volatile bool interrupt_received = false;
 static void InterruptHandler(int) {
   interrupt_received = true;
 }
 
-struct LedPixel {
-  uint8_t r, g, b;
-};
+// The RGB24 output of the scaler has the same memory layout as Color, so
+// rows can be handed to the canvas as they are.
+static_assert(sizeof(Color) == 3, "Color needs to be packed RGB");
+
 void CopyFrame(AVFrame *pFrame, FrameCanvas *canvas,
                int offset_x, int offset_y,
                int width, int height) {
   for (int y = 0; y < height; ++y) {
-    LedPixel *pix = (LedPixel*) (pFrame->data[0] + y*pFrame->linesize[0]);
-    for (int x = 0; x < width; ++x, ++pix) {
-      canvas->SetPixel(x + offset_x, y + offset_y, pix->r, pix->g, pix->b);
-    }
+    Color *row = (Color*) (pFrame->data[0] + y*pFrame->linesize[0]);
+    canvas->SetPixels(offset_x, y + offset_y, width, 1, row);
   }
 }
 
+// How many items can be in flight between two stages. Enough to smooth
+// over the varying time to decode different frames, small enough to not
+// add noticeable latency.
+static constexpr int kDecodedFrames = 4;
+static constexpr int kScaledFrames = 3;
+static constexpr int kCanvasPool = 3;
+
+static constexpr int kQueuePollMicros = 500;
+
+// Catching up when running behind: frames that are later than their time
+// slot are dropped before scaling, but never more than this many in a row,
+// so that even hopelessly slow playback still shows something.
+static constexpr int kMaxDroppedInRow = 8;
+// If decoded frames are this many frame durations late, ask the decoder to
+// skip non-reference frames and loop filtering until it is on time again.
+static constexpr int kDecoderCatchupFrames = 2;
+
+static int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Bounded queue handing items from exactly one producer thread to exactly
+// one consumer thread. It is lock-free, so a stage never waits for a lock
+// held by another stage; waiting for data or space is polling with a short
+// sleep, which is plenty for video frame rates.
+template <typename T>
+class StageQueue {
+public:
+  explicit StageQueue(int capacity)
+    : buffer_(capacity + 1), read_(0), write_(0) {}
+
+  bool TryPush(const T &item) {
+    const size_t w = write_.load(std::memory_order_relaxed);
+    const size_t next = (w + 1) % buffer_.size();
+    if (next == read_.load(std::memory_order_acquire))
+      return false;  // Full.
+    buffer_[w] = item;
+    write_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPop(T *item) {
+    const size_t r = read_.load(std::memory_order_relaxed);
+    if (r == write_.load(std::memory_order_acquire))
+      return false;  // Empty.
+    *item = buffer_[r];
+    read_.store((r + 1) % buffer_.size(), std::memory_order_release);
+    return true;
+  }
+
+  // Blocking versions. Return false if interrupted while waiting.
+  bool Push(const T &item) {
+    while (!TryPush(item)) {
+      if (interrupt_received) return false;
+      usleep(kQueuePollMicros);
+    }
+    return true;
+  }
+
+  bool Pop(T *item) {
+    while (!TryPop(item)) {
+      if (interrupt_received) return false;
+      usleep(kQueuePollMicros);
+    }
+    return true;
+  }
+
+private:
+  std::vector<T> buffer_;
+  std::atomic<size_t> read_;
+  std::atomic<size_t> write_;
+};
+
+// Frames and canvases on their way through the pipeline carry the number
+// of their time slot, which determines when they are due to be shown.
+struct SequencedFrame {
+  AVFrame *frame;
+  int64_t sequence;
+};
+
+struct SequencedCanvas {
+  FrameCanvas *canvas;
+  int64_t sequence;
+};
+
+// Everything the stages of the pipeline share while playing one video.
+// Frames travel decode -> scale -> encode -> present; the NULL item marks
+// the end of the video. Empty frames and canvases travel back in the free
+// queues to be re-used.
+struct VideoPipeline {
+  VideoPipeline(StageQueue<FrameCanvas*> *free_canvases,
+                StageQueue<SequencedCanvas> *encoded)
+    : decoded(kDecodedFrames), free_decoded(kDecodedFrames),
+      scaled(kScaledFrames), free_scaled(kScaledFrames),
+      free_canvases(free_canvases), encoded(encoded),
+      schedule_start(0), dropped_frames(0), decoder_catchups(0) {}
+
+  // How many nanoseconds the frame with the given sequence number is
+  // behind its time slot; negative if it is early. Zero before playback
+  // started.
+  int64_t Lateness(int64_t sequence) const {
+    const int64_t start = schedule_start.load(std::memory_order_acquire);
+    if (start == 0) return 0;
+    return NowNanos() - (start + sequence * frame_wait_nanos);
+  }
+
+  AVFormatContext *format_context;
+  AVCodecContext *codec_context;
+  int video_stream;
+  SwsContext *sws_ctx;       // Either this or yuv_scaler is set.
+  YUV420Scaler *yuv_scaler;  // Scales directly onto the canvas.
+
+  bool loop_forever;
+  unsigned int frame_skip;
+  int64_t framecount_limit;
+
+  int display_width, display_height;
+  int display_offset_x, display_offset_y;
+  bool letterboxed;
+
+  AVRational time_base;    // Of the timestamps in the video stream.
+  AVRational frame_rate;
+  long frame_wait_nanos;
+  bool drop_late_frames;   // Only if presentation follows the clock.
+
+  StageQueue<SequencedFrame> decoded;
+  StageQueue<AVFrame*> free_decoded;
+  StageQueue<SequencedFrame> scaled;
+  StageQueue<AVFrame*> free_scaled;
+  StageQueue<FrameCanvas*> *const free_canvases;  // Kept across videos.
+  StageQueue<SequencedCanvas> *const encoded;
+
+  // Set by the presenter when showing the first frame: time slot zero.
+  std::atomic<int64_t> schedule_start;
+
+  // Statistics.
+  std::atomic<int64_t> dropped_frames;
+  std::atomic<int64_t> decoder_catchups;   // Times we had to skip decoding.
+};
+
+// Demultiplex and decode.
+class DecodeStage : public rgb_matrix::Thread {
+public:
+  explicit DecodeStage(VideoPipeline *p) : p_(p) {}
+
+  void Run() override {
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *decode_frame = av_frame_alloc();  // Decode video into this
+    const int64_t catchup_lateness
+      = kDecoderCatchupFrames * (int64_t)p_->frame_wait_nanos;
+    bool catching_up = false;
+    int64_t sequence = 0;       // Of the next frame.
+    bool aborted = false;
+    do {
+      int64_t frames_left = p_->framecount_limit;
+      unsigned int frames_to_skip = p_->frame_skip;
+      if (p_->loop_forever) {
+        av_seek_frame(p_->format_context, p_->video_stream, 0,
+                      AVSEEK_FLAG_ANY);
+        avcodec_flush_buffers(p_->codec_context);
+      }
+
+      int decode_in_flight = 0;
+      bool state_reading = true;
+      // Time slots count from the first frame of each run through the video.
+      const int64_t first_sequence = sequence;
+      int64_t first_timestamp = AV_NOPTS_VALUE;
+
+      while (!aborted && !interrupt_received && frames_left > 0) {
+        if (state_reading &&
+            av_read_frame(p_->format_context, packet) != 0) {
+          state_reading = false;  // ran out of packets from input
+        }
+
+        if (!state_reading && decode_in_flight == 0)
+          break;  // Decoder fully drained.
+
+        // Is this a packet from the video stream?
+        if (state_reading && packet->stream_index != p_->video_stream) {
+          av_packet_unref(packet);
+          continue;  // Not interested in that.
+        }
+
+        if (state_reading) {
+          // Decode video frame
+          if (avcodec_send_packet(p_->codec_context, packet) == 0) {
+            ++decode_in_flight;
+          }
+          av_packet_unref(packet);
+        } else {
+          avcodec_send_packet(p_->codec_context, nullptr); // Trigger drain
+        }
+
+        while (decode_in_flight && frames_left > 0 &&
+               avcodec_receive_frame(p_->codec_context, decode_frame) == 0) {
+          --decode_in_flight;
+
+          if (frames_to_skip) { frames_to_skip--; continue; }
+
+          // Frames skipped by the decoder leave a gap in the timestamps;
+          // the following frames keep their time slots.
+          const int64_t timestamp = decode_frame->best_effort_timestamp;
+          if (timestamp != AV_NOPTS_VALUE) {
+            if (first_timestamp == AV_NOPTS_VALUE) first_timestamp = timestamp;
+            const AVRational slot = { p_->frame_rate.den, p_->frame_rate.num };
+            sequence = std::max(sequence, first_sequence
+                                + av_rescale_q(timestamp - first_timestamp,
+                                               p_->time_base, slot));
+          }
+
+          if (p_->drop_late_frames) {
+            const int64_t lateness = p_->Lateness(sequence);
+            if (!catching_up && lateness > catchup_lateness) {
+              SetDecoderCatchup(true);
+              catching_up = true;
+            } else if (catching_up && lateness < 0) {
+              SetDecoderCatchup(false);
+              catching_up = false;
+            }
+          }
+
+          SequencedFrame decoded;
+          if (!p_->free_decoded.Pop(&decoded.frame)) { aborted = true; break; }
+          av_frame_move_ref(decoded.frame, decode_frame);
+          decoded.sequence = sequence++;
+          if (!p_->decoded.Push(decoded)) { aborted = true; break; }
+          frames_left--;
+        }
+      }
+    } while (p_->loop_forever && !aborted && !interrupt_received);
+    const SequencedFrame end = { NULL, 0 };
+    p_->decoded.Push(end);
+
+    if (catching_up) SetDecoderCatchup(false);
+    av_packet_free(&packet);
+    av_frame_free(&decode_frame);
+  }
+
+private:
+  // Trade quality for speed: don't decode frames that no other frame
+  // depends on and skip the deblocking filter. Can be changed while
+  // decoding; we are the only thread using the codec context.
+  void SetDecoderCatchup(bool catchup) {
+    p_->codec_context->skip_frame
+      = catchup ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    p_->codec_context->skip_loop_filter
+      = catchup ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+    if (catchup) p_->decoder_catchups++;
+  }
+
+
+  VideoPipeline *const p_;
+};
+
+// Convert the image from its native format to RGB at display size. With
+// the YUV420Scaler, this goes directly onto the canvas, and there is no
+// separate encode stage.
+class ScaleStage : public rgb_matrix::Thread {
+public:
+  explicit ScaleStage(VideoPipeline *p) : p_(p) {}
+
+  void Run() override {
+    SequencedFrame in;
+    int dropped_in_row = 0;
+    while (p_->decoded.Pop(&in) && in.frame != NULL) {
+      // If this frame missed its time slot already, scaling and encoding
+      // it would only make the following frames late as well.
+      if (p_->drop_late_frames && dropped_in_row < kMaxDroppedInRow
+          && p_->Lateness(in.sequence) > 0) {
+        av_frame_unref(in.frame);
+        p_->free_decoded.Push(in.frame);
+        p_->dropped_frames++;
+        dropped_in_row++;
+        continue;
+      }
+      dropped_in_row = 0;
+
+      if (p_->yuv_scaler) {
+        if (!ScaleToCanvas(in)) break;
+        continue;
+      }
+
+      SequencedFrame out;
+      if (!p_->free_scaled.Pop(&out.frame)) break;
+      out.sequence = in.sequence;
+      sws_scale(p_->sws_ctx, (uint8_t const * const *)in.frame->data,
+                in.frame->linesize, 0, p_->codec_context->height,
+                out.frame->data, out.frame->linesize);
+      av_frame_unref(in.frame);
+      p_->free_decoded.Push(in.frame);
+      if (!p_->scaled.Push(out)) break;
+    }
+    if (p_->yuv_scaler) {
+      const SequencedCanvas end = { NULL, 0 };
+      p_->encoded->Push(end);
+    } else {
+      const SequencedFrame end = { NULL, 0 };
+      p_->scaled.Push(end);
+    }
+  }
+
+private:
+  bool ScaleToCanvas(const SequencedFrame &in) {
+    SequencedCanvas out;
+    if (!p_->free_canvases->Pop(&out.canvas)) return false;
+    out.sequence = in.sequence;
+    if (p_->letterboxed) out.canvas->Clear();
+    const YUV420Image image = {
+      p_->codec_context->width, p_->codec_context->height,
+      in.frame->data[0], in.frame->data[1], in.frame->data[2],
+      in.frame->linesize[0], in.frame->linesize[1], in.frame->linesize[2],
+    };
+    p_->yuv_scaler->Scale(image, out.canvas,
+                          p_->display_offset_x, p_->display_offset_y);
+    av_frame_unref(in.frame);
+    p_->free_decoded.Push(in.frame);
+    return p_->encoded->Push(out);
+  }
+
+  VideoPipeline *const p_;
+};
+
+// Encode the RGB image into the bitplanes of a FrameCanvas.
+class EncodeStage : public rgb_matrix::Thread {
+public:
+  explicit EncodeStage(VideoPipeline *p) : p_(p) {}
+
+  void Run() override {
+    SequencedFrame in;
+    while (p_->scaled.Pop(&in) && in.frame != NULL) {
+      SequencedCanvas out;
+      if (!p_->free_canvases->Pop(&out.canvas)) break;
+      out.sequence = in.sequence;
+      // Canvases are re-used, so make sure the bars are black.
+      if (p_->letterboxed) out.canvas->Clear();
+      CopyFrame(in.frame, out.canvas,
+                p_->display_offset_x, p_->display_offset_y,
+                p_->display_width, p_->display_height);
+      p_->free_scaled.Push(in.frame);
+      if (!p_->encoded->Push(out)) break;
+    }
+    const SequencedCanvas end = { NULL, 0 };
+    p_->encoded->Push(end);
+  }
+
+private:
+  VideoPipeline *const p_;
+};
+
 // Scale "width" and "height" to fit within target rectangle of given size.
 void ScaleToFitKeepAscpet(int fit_in_width, int fit_in_height,
                           int *width, int *height) {
@@ -95,6 +457,7 @@ static int usage(const char *progname, const char *msg = NULL) {
   fprintf(stderr, "Options:\n"
           "\t-F                 : Full screen without black bars; aspect ratio might suffer\n"
           "\t-O<streamfile>     : Output to stream-file instead of matrix (don't need to be root).\n"
+          "\t-k<directory>      : Cache rendered videos in this directory; they play from there next time.\n"
           "\t-s <count>         : Skip these number of frames in the beginning.\n"
           "\t-c <count>         : Only show this number of frames (excluding skipped frames).\n"
           "\t-V<vsync-multiple> : Instead of native video framerate, playback framerate\n"
@@ -102,6 +465,9 @@ static int usage(const char *progname, const char *msg = NULL) {
           "\t                     this can result in more smooth playback. Choose multiple for desired framerate.\n"
           "\t                     (Tip: use --led-limit-refresh for stable rate)\n"
 	  "\t-T <threads>       : Number of threads used to decode (default 1, max=%d)\n"
+          "\t-D                 : Don't drop frames if decoding can't keep up; slow down instead.\n"
+          "\t-S                 : Always scale with libswscale, not directly onto the matrix.\n"
+          "\t-H                 : Use hardware decoder (V4L2) if available.\n"
           "\t-v                 : verbose; prints video metadata and other info.\n"
           "\t-f                 : Loop forever.\n",
 	  (int)std::thread::hardware_concurrency());
@@ -111,12 +477,98 @@ static int usage(const char *progname, const char *msg = NULL) {
   return 1;
 }
 
-static void add_nanos(struct timespec *accumulator, long nanoseconds) {
-  accumulator->tv_nsec += nanoseconds;
-  while (accumulator->tv_nsec > 1000000000) {
-    accumulator->tv_nsec -= 1000000000;
-    accumulator->tv_sec += 1;
+static struct timespec NanosToTimespec(int64_t nanos) {
+  struct timespec result;
+  result.tv_sec = nanos / 1000000000;
+  result.tv_nsec = nanos % 1000000000;
+  return result;
+}
+
+// Show a stream rendered before, with the timing it was rendered with, or
+// write it to "stream_writer" if not NULL. Returns the number of frames.
+static long PlayStream(StreamIO *stream, RGBMatrix *matrix,
+                       FrameCanvas **canvas, StreamWriter *stream_writer,
+                       int vsync_multiple, bool use_vsync_for_frame_timing) {
+  StreamReader reader(stream);
+  long frames = 0;
+  int64_t next_frame_nanos = NowNanos();
+  uint32_t hold_time_us;
+  while (!interrupt_received && reader.GetNext(*canvas, &hold_time_us)) {
+    next_frame_nanos += hold_time_us * 1000LL;
+    frames++;
+    if (stream_writer) {
+      stream_writer->Stream(**canvas, hold_time_us);
+      continue;
+    }
+    *canvas = matrix->SwapOnVSync(*canvas, vsync_multiple);
+    if (!use_vsync_for_frame_timing) {
+      const struct timespec next_frame = NanosToTimespec(next_frame_nanos);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+    }
+  }
+  return frames;
+}
+
+// The V4L2 memory-to-memory decoder for the given codec if available,
+// e.g. for the hardware video decoder of the Raspberry Pi. NULL otherwise,
+// e.g. if ffmpeg was compiled without it.
+static const AVCodec *FindHardwareDecoder(AVCodecID codec_id) {
+  static const struct {
+    AVCodecID codec_id;
+    const char *decoder;
+  } kHardwareDecoders[] = {
+    { AV_CODEC_ID_H264,       "h264_v4l2m2m" },
+    { AV_CODEC_ID_HEVC,       "hevc_v4l2m2m" },
+    { AV_CODEC_ID_MPEG2VIDEO, "mpeg2_v4l2m2m" },
+    { AV_CODEC_ID_MPEG4,      "mpeg4_v4l2m2m" },
+    { AV_CODEC_ID_VC1,        "vc1_v4l2m2m" },
+    { AV_CODEC_ID_VP8,        "vp8_v4l2m2m" },
+    { AV_CODEC_ID_VP9,        "vp9_v4l2m2m" },
+  };
+  for (const auto &d : kHardwareDecoders) {
+    if (d.codec_id == codec_id)
+      return avcodec_find_decoder_by_name(d.decoder);
+  }
+  return NULL;
+}
+
+// Largest reduction of the decoded resolution (as power of two) the
+// decoder supports that still leaves at least "width" x "height" pixels.
+static int ChooseLowres(const AVCodec *codec, const AVCodecParameters *params,
+                        int width, int height) {
+  int lowres = 0;
+  while (lowres < codec->max_lowres
+         && (params->width >> (lowres + 1)) >= width
+         && (params->height >> (lowres + 1)) >= height) {
+    ++lowres;
   }
+  return lowres;
+}
+
+// Create and open a decoder context. Returns NULL if the decoder can't be
+// used, e.g. if the device of a hardware decoder is missing.
+static AVCodecContext *OpenDecoder(const AVCodec *codec,
+                                   const AVCodecParameters *params,
+                                   unsigned thread_count, int lowres) {
+  AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+  if (!codec_context) return NULL;
+  if (thread_count > 1 &&
+      codec->capabilities & AV_CODEC_CAP_FRAME_THREADS &&
+      std::thread::hardware_concurrency() > 1) {
+    codec_context->thread_type = FF_THREAD_FRAME;
+    codec_context->thread_count =
+      std::min(thread_count, std::thread::hardware_concurrency());
+  }
+  if (avcodec_parameters_to_context(codec_context, params) < 0) {
+    avcodec_free_context(&codec_context);
+    return NULL;
+  }
+  codec_context->lowres = lowres;
+  if (avcodec_open2(codec_context, codec, NULL) < 0) {
+    avcodec_free_context(&codec_context);
+    return NULL;
+  }
+  return codec_context;
 }
 
 // Convert deprecated color formats to new and manually set the color range.
@@ -176,13 +628,17 @@ int main(int argc, char *argv[]) {
   bool maintain_aspect_ratio = true;
   bool verbose = false;
   bool forever = false;
+  bool drop_late_frames = true;
+  bool direct_yuv_scaling = true;
+  bool hardware_decode = false;
   unsigned thread_count = 1;
   int stream_output_fd = -1;
+  const char *cache_dir = NULL;
   unsigned int frame_skip = 0;
   int64_t framecount_limit = INT64_MAX;
 
   int opt;
-  while ((opt = getopt(argc, argv, "vO:R:Lfc:s:FV:T:")) != -1) {
+  while ((opt = getopt(argc, argv, "vO:k:R:Lfc:s:FV:T:DSH")) != -1) {
     switch (opt) {
     case 'v':
       verbose = true;
@@ -197,6 +653,9 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       break;
+    case 'k':
+      cache_dir = optarg;
+      break;
     case 'L':
       fprintf(stderr, "-L is deprecated. Use\n\t--led-pixel-mapper=\"U-mapper\" --led-chain=4\ninstead.\n");
       return 1;
@@ -218,6 +677,15 @@ int main(int argc, char *argv[]) {
     case 'F':
       maintain_aspect_ratio = false;
       break;
+    case 'D':
+      drop_late_frames = false;
+      break;
+    case 'S':
+      direct_yuv_scaling = false;
+      break;
+    case 'H':
+      hardware_decode = true;
+      break;
     case 'V':
       vsync_multiple = atoi(optarg);
       if (vsync_multiple <= 0)
@@ -243,9 +711,21 @@ int main(int argc, char *argv[]) {
   if (matrix == NULL) {
     return 1;
   }
-  FrameCanvas *offscreen_canvas = matrix->CreateFrameCanvas();
+
+  // Canvases circulate between encoding and presentation. Swapping returns
+  // the previously shown canvas, so there is one more than we create.
+  StageQueue<FrameCanvas*> free_canvases(kCanvasPool + 1);
+  StageQueue<SequencedCanvas> encoded_canvases(kCanvasPool + 1);
+  for (int i = 0; i < kCanvasPool; ++i) {
+    free_canvases.Push(matrix->CreateFrameCanvas());
+  }
+
+  // Each stage gets its own core; the last core is used by the matrix
+  // refresh thread, so we stay away from that one.
+  const bool pin_stages = std::thread::hardware_concurrency() >= 4;
 
   long frame_count = 0;
+  int64_t dropped_count = 0;
   StreamIO *stream_io = NULL;
   StreamWriter *stream_writer = NULL;
   if (stream_output_fd >= 0) {
@@ -257,10 +737,26 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // Rendered videos are kept in the cache, keyed by their content and
+  // everything that changes how they are rendered.
+  StreamCache *cache = NULL;
+  std::string cache_options;
+  std::vector<std::string> cache_keys(argc);   // Per argument; computed once.
+  if (cache_dir) {
+    cache = new StreamCache(cache_dir);
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer),
+             "video-viewer;aspect=%d;yuv=%d;hw=%d;skip=%u;count=%lld",
+             maintain_aspect_ratio, direct_yuv_scaling, hardware_decode,
+             frame_skip, (long long)framecount_limit);
+    cache_options = buffer;
+  }
+
   // If we only have to loop a single video, we can avoid doing the
-  // expensive video stream set-up and just repeat in an inner loop.
-  const bool one_video_forever = forever && !multiple_videos;
-  const bool multiple_video_forever = forever && multiple_videos;
+  // expensive video stream set-up and just repeat in an inner loop. With a
+  // cache, the next round plays from there instead.
+  const bool one_video_forever = forever && !multiple_videos && !cache;
+  const bool multiple_video_forever = forever && !one_video_forever;
 
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
   av_register_all();
@@ -278,6 +774,27 @@ int main(int argc, char *argv[]) {
         movie_file = "/dev/stdin";
       }
 
+      // Only files can be looked up; reading a pipe would consume it.
+      struct stat st;
+      if (cache && cache_keys[m].empty()
+          && stat(movie_file, &st) == 0 && S_ISREG(st.st_mode)) {
+        cache_keys[m] = StreamCache::MakeKey(movie_file, matrix_options,
+                                             cache_options);
+      }
+      StreamIO *cached = cache ? cache->Open(cache_keys[m]) : NULL;
+      if (cached) {
+        if (verbose) fprintf(stderr, "%s: playing from cache\n", movie_file);
+        FrameCanvas *canvas;
+        if (free_canvases.Pop(&canvas)) {
+          frame_count += PlayStream(cached, matrix, &canvas, stream_writer,
+                                    vsync_multiple,
+                                    use_vsync_for_frame_timing);
+          free_canvases.Push(canvas);
+        }
+        delete cached;
+        continue;
+      }
+
       AVFormatContext *format_context = avformat_alloc_context();
       if (avformat_open_input(&format_context, movie_file, NULL, NULL) != 0) {
         perror("Issue opening file: ");
@@ -313,19 +830,43 @@ int main(int argc, char *argv[]) {
       const long frame_wait_nanos = 1e9 * rate.den / rate.num;
       if (verbose) fprintf(stderr, "FPS: %f\n", 1.0*rate.num / rate.den);
 
-      AVCodecContext *codec_context = avcodec_alloc_context3(av_codec);
-      if (thread_count > 1 &&
-          av_codec->capabilities & AV_CODEC_CAP_FRAME_THREADS &&
-          std::thread::hardware_concurrency() > 1) {
-        codec_context->thread_type = FF_THREAD_FRAME;
-        codec_context->thread_count =
-          std::min(thread_count, std::thread::hardware_concurrency());
+      AVCodecContext *codec_context = NULL;
+      if (hardware_decode) {
+        const AVCodec *hw_codec = FindHardwareDecoder(
+          codec_parameters->codec_id);
+        if (hw_codec) {
+          codec_context = OpenDecoder(hw_codec, codec_parameters,
+                                      thread_count, 0);
+        }
+        if (codec_context) {
+          if (verbose) fprintf(stderr, "Decoding with %s\n", hw_codec->name);
+        } else {
+          fprintf(stderr, "No hardware decoder available for %s; "
+                  "decoding in software.\n",
+                  avcodec_get_name(codec_parameters->codec_id));
+        }
+      }
+      if (!codec_context) {
+        // Not more pixels than we need: some decoders can directly decode
+        // at a fraction of the resolution.
+        int target_width = matrix->width();
+        int target_height = matrix->height();
+        if (maintain_aspect_ratio) {
+          target_width = codec_parameters->width;
+          target_height = codec_parameters->height;
+          ScaleToFitKeepAscpet(matrix->width(), matrix->height(),
+                               &target_width, &target_height);
+        }
+        const int lowres = ChooseLowres(av_codec, codec_parameters,
+                                        target_width, target_height);
+        if (verbose && lowres > 0) {
+          fprintf(stderr, "Decoding at 1/%d resolution\n", 1 << lowres);
+        }
+        codec_context = OpenDecoder(av_codec, codec_parameters,
+                                    thread_count, lowres);
+        if (!codec_context)
+          return -1;
       }
-
-      if (avcodec_parameters_to_context(codec_context, codec_parameters) < 0)
-        return -1;
-      if (avcodec_open2(codec_context, av_codec, NULL) < 0)
-        return -1;
 
       /*
        * Prepare frame to hold the scaled target frame to be send to matrix.
@@ -346,14 +887,6 @@ int main(int argc, char *argv[]) {
       const int display_offset_x = (matrix->width() - display_width)/2;
       const int display_offset_y = (matrix->height() - display_height)/2;
 
-      // The output_frame_ will receive the scaled result.
-      AVFrame *output_frame = av_frame_alloc();
-      if (av_image_alloc(output_frame->data, output_frame->linesize,
-                         display_width, display_height, AV_PIX_FMT_RGB24,
-                         64) < 0) {
-        return -1;
-      }
-
       if (verbose) {
         fprintf(stderr, "Scaling %dx%d -> %dx%d; black border x:%d y:%d\n",
                 codec_context->width, codec_context->height,
@@ -361,95 +894,151 @@ int main(int argc, char *argv[]) {
                 display_offset_x, display_offset_y);
       }
 
-      // initialize SWS context for software scaling
-      SwsContext *const sws_ctx = CreateSWSContext(
-        codec_context, display_width, display_height);
-      if (!sws_ctx) {
-        fprintf(stderr, "Trouble doing scaling to %dx%d :(\n",
-                matrix->width(), matrix->height());
-        return 1;
+      // The most common decoder output, YUV 4:2:0, we can shrink directly
+      // onto the canvas, saving the RGB image in between. Everything else
+      // goes through the software scaler of libswscale.
+      SwsContext *sws_ctx = NULL;
+      YUV420Scaler *yuv_scaler = NULL;
+      if (direct_yuv_scaling &&
+          (codec_context->pix_fmt == AV_PIX_FMT_YUV420P ||
+           codec_context->pix_fmt == AV_PIX_FMT_YUVJ420P) &&
+          display_width <= codec_context->width &&
+          display_height <= codec_context->height) {
+        const bool full_range =
+          (codec_context->pix_fmt == AV_PIX_FMT_YUVJ420P ||
+           codec_context->color_range == AVCOL_RANGE_JPEG);
+        yuv_scaler = new YUV420Scaler(
+          codec_context->width, codec_context->height,
+          display_width, display_height,
+          codec_context->colorspace == AVCOL_SPC_BT709
+          ? YUV420Scaler::BT709 : YUV420Scaler::BT601,
+          full_range);
+        if (verbose) fprintf(stderr, "Scaling YUV directly onto matrix\n");
+      } else {
+        // initialize SWS context for software scaling
+        sws_ctx = CreateSWSContext(codec_context,
+                                   display_width, display_height);
+        if (!sws_ctx) {
+          fprintf(stderr, "Trouble doing scaling to %dx%d :(\n",
+                  matrix->width(), matrix->height());
+          return 1;
+        }
       }
 
+      VideoPipeline pipeline(&free_canvases, &encoded_canvases);
+      pipeline.format_context = format_context;
+      pipeline.codec_context = codec_context;
+      pipeline.video_stream = videoStream;
+      pipeline.sws_ctx = sws_ctx;
+      pipeline.yuv_scaler = yuv_scaler;
+      pipeline.loop_forever = one_video_forever;
+      pipeline.frame_skip = frame_skip;
+      pipeline.framecount_limit = framecount_limit;
+      pipeline.display_width = display_width;
+      pipeline.display_height = display_height;
+      pipeline.display_offset_x = display_offset_x;
+      pipeline.display_offset_y = display_offset_y;
+      pipeline.letterboxed = (display_width != matrix->width() ||
+                              display_height != matrix->height());
+      pipeline.time_base = stream->time_base;
+      pipeline.frame_rate = rate;
+      pipeline.frame_wait_nanos = frame_wait_nanos;
+      // Record what is shown for the cache. Only complete renderings are
+      // kept there, so no frames are dropped while recording.
+      rgb_matrix::StreamCacheEntry *cache_entry
+        = cache ? cache->CreateEntry(cache_keys[m]) : NULL;
+      StreamWriter *cache_writer
+        = cache_entry ? new StreamWriter(cache_entry) : NULL;
 
-      struct timespec next_frame;
+      // When writing a stream, every frame counts; with vsync timing, the
+      // display sets the pace, not the clock.
+      pipeline.drop_late_frames = (drop_late_frames && !stream_writer &&
+                                   !cache_writer &&
+                                   !use_vsync_for_frame_timing);
 
-      AVPacket *packet = av_packet_alloc();
-      AVFrame *decode_frame = av_frame_alloc();  // Decode video into this
-      do {
-        int64_t frames_left = framecount_limit;
-        unsigned int frames_to_skip = frame_skip;
-        if (one_video_forever) {
-          av_seek_frame(format_context, videoStream, 0, AVSEEK_FLAG_ANY);
-          avcodec_flush_buffers(codec_context);
+      std::vector<AVFrame*> frames;  // All frames in the pipeline; for cleanup
+      for (int i = 0; i < kDecodedFrames; ++i) {
+        frames.push_back(av_frame_alloc());
+        pipeline.free_decoded.Push(frames.back());
+      }
+      // The scaled frames receive the result at display size.
+      for (int i = 0; sws_ctx && i < kScaledFrames; ++i) {
+        AVFrame *output_frame = av_frame_alloc();
+        if (av_image_alloc(output_frame->data, output_frame->linesize,
+                           display_width, display_height, AV_PIX_FMT_RGB24,
+                           64) < 0) {
+          return -1;
         }
-        clock_gettime(CLOCK_MONOTONIC, &next_frame);
-
-        int decode_in_flight = 0;
-        bool state_reading = true;
-
-        while (!interrupt_received && frames_left > 0) {
-          if (state_reading &&
-              av_read_frame(format_context, packet) != 0) {
-            state_reading = false;  // ran out of packets from input
-          }
-
-          if (!state_reading && decode_in_flight == 0)
-            break;  // Decoder fully drained.
-
-          // Is this a packet from the video stream?
-          if (state_reading && packet->stream_index != videoStream) {
-            av_packet_unref(packet);
-            continue;  // Not interested in that.
-          }
+        frames.push_back(output_frame);
+        pipeline.free_scaled.Push(output_frame);
+      }
 
-          if (state_reading) {
-            // Decode video frame
-            if (avcodec_send_packet(codec_context, packet) == 0) {
-              ++decode_in_flight;
-            }
-            av_packet_unref(packet);
-          } else {
-            avcodec_send_packet(codec_context, nullptr); // Trigger decode drain
-          }
+      DecodeStage decode_stage(&pipeline);
+      ScaleStage scale_stage(&pipeline);
+      EncodeStage encode_stage(&pipeline);
+      decode_stage.Start(0, pin_stages ? (1<<0) : 0);
+      scale_stage.Start(0, pin_stages ? (1<<1) : 0);
+      if (sws_ctx) encode_stage.Start(0, pin_stages ? (1<<2) : 0);
 
-          while (decode_in_flight &&
-                 avcodec_receive_frame(codec_context, decode_frame) == 0) {
-            --decode_in_flight;
-
-            if (frames_to_skip) { frames_to_skip--; continue; }
-
-            // Determine absolute end of this frame now so that we don't include
-            // decoding overhead. TODO: skip frames if getting too slow ?
-            add_nanos(&next_frame, frame_wait_nanos);
-
-            // Convert the image from its native format to RGB
-            sws_scale(sws_ctx, (uint8_t const * const *)decode_frame->data,
-                      decode_frame->linesize, 0, codec_context->height,
-                      output_frame->data, output_frame->linesize);
-            CopyFrame(output_frame, offscreen_canvas,
-                      display_offset_x, display_offset_y,
-                      display_width, display_height);
-            frame_count++;
-            frames_left--;
-            if (stream_writer) {
-              if (verbose) fprintf(stderr, "%6ld", frame_count);
-              stream_writer->Stream(*offscreen_canvas, frame_wait_nanos/1000);
-            } else {
-              offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas,
-                                                     vsync_multiple);
-            }
-            if (!stream_writer && !use_vsync_for_frame_timing) {
-              clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
-            }
-          }
+      // Present frames as they come out of the pipeline. Each frame is
+      // shown until the time slot after its own starts, so frames dropped
+      // on the way don't slow down playback.
+      const long video_frames_before = frame_count;
+      SequencedCanvas encoded;
+      while (encoded_canvases.Pop(&encoded) && encoded.canvas != NULL) {
+        if (pipeline.schedule_start == 0) {
+          pipeline.schedule_start = NowNanos();
+        }
+        // Determine absolute end of this frame now so that we don't include
+        // the time to show it.
+        const struct timespec next_frame = NanosToTimespec(
+          pipeline.schedule_start + (encoded.sequence + 1) * frame_wait_nanos);
+        frame_count++;
+        if (cache_writer) {
+          cache_writer->Stream(*encoded.canvas, frame_wait_nanos/1000);
+        }
+        if (stream_writer) {
+          if (verbose) fprintf(stderr, "%6ld", frame_count);
+          stream_writer->Stream(*encoded.canvas, frame_wait_nanos/1000);
+          free_canvases.Push(encoded.canvas);
+        } else {
+          free_canvases.Push(matrix->SwapOnVSync(encoded.canvas,
+                                                 vsync_multiple));
         }
-      } while (one_video_forever && !interrupt_received);
+        if (!stream_writer && !use_vsync_for_frame_timing) {
+          clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+        }
+      }
 
-      av_packet_free(&packet);
+      decode_stage.WaitStopped();
+      scale_stage.WaitStopped();
+      encode_stage.WaitStopped();
 
-      av_frame_free(&output_frame);
-      av_frame_free(&decode_frame);
-      avcodec_close(codec_context);
+      dropped_count += pipeline.dropped_frames;
+      if (cache_entry && !interrupt_received) {
+        delete cache_writer;
+        cache_writer = NULL;
+        cache_entry->Commit();
+      }
+      delete cache_writer;
+      delete cache_entry;   // Discarded if not committed.
+      if (verbose) {
+        fprintf(stderr, "%s: %ld frames shown, %lld dropped; "
+                "decoder had to catch up %lld times.\n", movie_file,
+                frame_count - video_frames_before,
+                (long long)pipeline.dropped_frames,
+                (long long)pipeline.decoder_catchups);
+      }
+
+      for (size_t i = kDecodedFrames; i < frames.size(); ++i) {
+        av_freep(&frames[i]->data[0]);  // Allocated with av_image_alloc()
+      }
+      for (size_t i = 0; i < frames.size(); ++i) {
+        av_frame_free(&frames[i]);
+      }
+      if (sws_ctx) sws_freeContext(sws_ctx);
+      delete yuv_scaler;
+      avcodec_free_context(&codec_context);
       avformat_close_input(&format_context);
     }
   } while (multiple_video_forever && !interrupt_received);
@@ -463,7 +1052,12 @@ int main(int argc, char *argv[]) {
   delete matrix;
   delete stream_writer;
   delete stream_io;
-  fprintf(stderr, "Total of %ld frames decoded\n", frame_count);
+  delete cache;
+  fprintf(stderr, "Total of %ld frames decoded", frame_count);
+  if (dropped_count > 0) {
+    fprintf(stderr, "; %lld more dropped to keep up", (long long)dropped_count);
+  }
+  fprintf(stderr, "\n");
 
   return 0;
 }